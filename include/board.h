@@ -0,0 +1,63 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include "grid.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Outcome of board_next() */
+typedef enum
+{
+  BOARD_SOLVED,     /* a solution was found, see board_solution() */
+  BOARD_EXHAUSTED,  /* no solution is left */
+  BOARD_STOPPED     /* the node callback asked to stop */
+} board_status_t;
+
+/* Called on each search node, return false to stop the search */
+typedef bool (*board_node_t) (void *data);
+
+/* Search engine dedicated to 9x9 grids. Each digit has a bitboard of the
+   81 cells where it is still possible, so singles, box/line interactions
+   and consistency checks are bitwise operations on whole boards, and the
+   candidates of a cell are read across the 9 bitboards. The search is
+   resumable like the one of the solver: each call of board_next() goes on
+   up to the next solution. */
+typedef struct board_t board_t;
+
+/* Create an engine */
+board_t *board_new (void);
+
+/* Free the memory of board_t */
+void board_free (board_t *board);
+
+/* Bytes taken by an engine, fixed whatever the search */
+size_t board_sizeof (void);
+
+/* Start a new search from a 9x9 grid, false for other sizes */
+bool board_load (board_t *board, const grid_t *grid);
+
+/* Resume the search up to the next solution. Choices take the digits of a
+   cell in increasing order, or in random order drawn with seed if it is
+   not NULL. */
+board_status_t board_next (board_t *board, uint64_t *seed,
+                           board_node_t node, void *data);
+
+/* Write the last solution found in a 9x9 grid */
+void board_solution (const board_t *board, grid_t *grid);
+
+/* Number of grids propagated together by board_heuristics() */
+#define BOARD_LANES 32
+
+/* Apply naked and hidden singles to many 9x9 grids at once, up to a fixed
+   point. The grids are taken BOARD_LANES at a time, one per lane of vectors
+   of 16-bit candidate sets, so that each step works on all of them; the
+   vectors are AVX-512 or AVX2 ones when the processor has them. results[i]
+   gets SOLVED, NOT_CONSISTENT or CONSISTENT_NOT_SOLVED like
+   grid_heuristics() for grids[i], which holds the candidates left unless it
+   is not consistent. Grids of other sizes are left untouched and get
+   CONSISTENT_NOT_SOLVED. */
+void board_heuristics (grid_t *grids[], const size_t count, size_t results[]);
+
+#endif /* BOARD_H */
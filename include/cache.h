@@ -0,0 +1,37 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "canon.h"
+#include "grid.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Number of solutions that was never counted */
+#define CACHE_UNKNOWN SIZE_MAX
+
+/* In-memory cache of results keyed by the canonical form of the grids, the
+   least recently used result is dropped when it is full. A cache may be
+   shared by several threads. */
+typedef struct cache_t cache_t;
+
+/* Create a cache holding up to capacity results, NULL if it is 0 or too
+   large */
+cache_t *cache_new (const size_t capacity);
+
+/* Free the memory of cache_t */
+void cache_free (cache_t *cache);
+
+/* Look up the result of a grid. On a hit, count is the number of solutions
+   (CACHE_UNKNOWN if it was never counted) and solution a solution mapped
+   back to the grid (NULL if none is known), freed by the caller. */
+bool cache_get (cache_t *cache, const canon_t *canon, size_t *count,
+                grid_t **solution);
+
+/* Record a result, merged with the one already known for the grid.
+   count may be CACHE_UNKNOWN and solution NULL. */
+void cache_put (cache_t *cache, const canon_t *canon, const size_t count,
+                const grid_t *solution);
+
+#endif /* CACHE_H */
@@ -0,0 +1,45 @@
+#ifndef CANON_H
+#define CANON_H
+
+#include "grid.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Largest number of orderings tried among rows, columns, bands and stacks
+   that can't be told apart, above it the form is no longer canonical */
+#define CANON_BUDGET 4096
+
+/* Canonical form of the givens of a grid under the Sudoku symmetries:
+   transposition, permutations of bands and stacks, of rows inside a band,
+   of columns inside a stack, and relabeling of the colors. Equivalent grids
+   get the same key, and the transform maps results back and forth. */
+typedef struct canon_t canon_t;
+
+/* Compute the canonical form of the singleton cells of a grid */
+canon_t *canon_new (const grid_t *grid);
+
+/* Free the memory of canon_t */
+void canon_free (canon_t *canon);
+
+/* Get the size of the grid */
+size_t canon_get_size (const canon_t *canon);
+
+/* Key of the canonical form: one byte per cell in row order, 0 for empty
+   cells and the canonical color + 1 for givens */
+const unsigned char *canon_get_key (const canon_t *canon);
+
+/* Hash of the key */
+uint64_t canon_hash (const canon_t *canon);
+
+/* Write a solution of the grid in canonical coordinates, one byte per cell
+   as in the key */
+void canon_encode (const canon_t *canon, const grid_t *grid,
+                   unsigned char *cells);
+
+/* Map cells in canonical coordinates back to a grid of the original
+   coordinates */
+grid_t *canon_decode (const canon_t *canon, const unsigned char *cells);
+
+#endif /* CANON_H */
@@ -5,9 +5,23 @@
 #include <stdint.h>
 #include <stdio.h>
 
-#define MAX_COLORS 64
+/* Words of 64 bits of a colors_t. A single word is enough for grids up to
+   64x64, two words (make WIDE=1) go up to 100x100 at the cost of slower
+   set operations. */
+#ifndef COLORS_WORDS
+#define COLORS_WORDS 1
+#endif
 
+#define MAX_COLORS (64 * COLORS_WORDS)
+
+#if COLORS_WORDS == 1
 typedef uint64_t colors_t;
+#else
+typedef struct
+{
+  uint64_t words[COLORS_WORDS];
+} colors_t;
+#endif
 
 /* Initialize all colors within size */
 colors_t colors_full(const size_t size);
@@ -48,22 +62,40 @@ bool colors_is_equal (const colors_t colors1, const colors_t colors2);
 /* Inclusion test between two colors_t */
 bool colors_is_subset (const colors_t colors1, const colors_t colors2);
 
+/* Check if colors_t is empty */
+bool colors_is_empty (const colors_t colors);
+
 /* Check if colors_t is a singleton */
 bool colors_is_singleton (const colors_t colors);
 
 /* Return cardinality of colors_t */
 size_t colors_count (const colors_t colors);
 
+/* Index of the rightmost color of a colors_t, MAX_COLORS if empty */
+size_t colors_index (const colors_t colors);
+
 /* Rightmost color of a colors_t */
 colors_t colors_rightmost (const colors_t colors);
 
 /* Leftmost color of a colors_t */
 colors_t colors_leftmost (const colors_t colors);
 
+/* Transpose the size x size bit matrix of rows into columns: color j of
+   *rows[i] becomes color i of columns[j]. For the cells of a subgrid, it
+   gives the cells where each color is possible. */
+void colors_transpose (colors_t *const rows[], colors_t columns[],
+                       const size_t size);
+
 /* Return random color of a colors_t, PRNG need to be initialized with srand()
    before calling this function. */
 colors_t colors_random(const colors_t colors);
 
+/* Return random color of a colors_t, drawn with the PRNG state seed */
+colors_t colors_random_r (const colors_t colors, uint64_t *seed);
+
+/* Return a pseudo-random number and update the PRNG state seed */
+uint64_t random_next (uint64_t *seed);
+
 /* Return cardinality and all colors in colors_t */
 colors_t *colors_get_set (const colors_t colors);
 
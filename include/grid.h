@@ -2,12 +2,28 @@
 #define GRID_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "colors.h"
+
+#if COLORS_WORDS == 1
 #define MAX_GRID_SIZE 64
+#define GRID_SIZES "1,4,9,16,25,36,49,64"
+#else
+#define MAX_GRID_SIZE 100
+#define GRID_SIZES "1,4,9,16,25,36,49,64,81,100"
+#endif
+
+/* Largest grid written with one character of color_table per cell, larger
+   grids use the numeric syntax: colors 1 to N separated by blanks */
+#define COLOR_TABLE_SIZE 64
 #define EMPTY_CELL '_'
 
+/* Smallest grid whose propagation is shared by grid_set_threads() */
+#define GRID_PARALLEL_SIZE 36
+
 #define NOT_CONSISTENT 2
 #define SOLVED 1
 #define CONSISTENT_NOT_SOLVED 0
@@ -18,6 +34,9 @@ static const char color_table[] =
 /* Sudoku grid */
 typedef struct _grid_t grid_t;
 
+/* Pool of grids of a same size, recycled without going through malloc */
+typedef struct grid_pool_t grid_pool_t;
+
 /* Sudoku grid choice */
 typedef struct choice_t choice_t;
 
@@ -27,16 +46,44 @@ bool grid_check_char (const grid_t *grid, const char c);
 /* Allocate memory for new grid */
 grid_t *grid_alloc (size_t size);
 
-/* Free the memory of grid_t */
+/* Parse a grid written in the text format from a buffer in memory.
+   On failure, return NULL and describe the problem in error. */
+grid_t *grid_parse (const char *buffer, size_t length,
+                    char *error, size_t error_size);
+
+/* Free the memory of grid_t, or give it back to its pool */
 void grid_free (grid_t *grid);
 
+/* Create an empty pool for grids of the given size */
+grid_pool_t *grid_pool_new (size_t size);
+
+/* Free the pool and every grid taken from it */
+void grid_pool_free (grid_pool_t *pool);
+
+/* Give back every grid taken from the pool at once, they must not be used
+   anymore. The memory is kept for the next grids. */
+void grid_pool_reset (grid_pool_t *pool);
+
+/* Get the size of the grids of the pool */
+size_t grid_pool_get_size (const grid_pool_t *pool);
+
+/* Allocate a grid from the pool */
+grid_t *grid_pool_alloc (grid_pool_t *pool);
+
+/* Deep copy of a grid into the pool, or into the heap if pool is NULL */
+grid_t *grid_pool_copy (grid_pool_t *pool, const grid_t *grid);
+
 /* Write the grid in the file descriptor fd */
 void grid_print (const grid_t *grid, FILE *fd);
 
-/* Check if grid's size is among 1, 4, 9, 16, 25, 36, 49, 64 */
+/* Memory footprint in bytes of a grid of the given size */
+size_t grid_sizeof (const size_t size);
+
+/* Check if grid's size is a perfect square up to MAX_GRID_SIZE: one of
+   GRID_SIZES, 81 and 100 only in the WIDE=1 build */
 bool grid_check_size (const size_t size);
 
-/* Deep copy of a grid */
+/* Deep copy of a grid, taken from the same pool as the original */
 grid_t *grid_copy (const grid_t *grid);
 
 /* Get the content of a cell */
@@ -49,15 +96,36 @@ size_t grid_get_size (const grid_t *grid);
 void grid_set_cell (grid_t *grid, const size_t row, 
                     const size_t column, const char color);
 
+/* Get the candidates of a cell */
+colors_t grid_get_colors (const grid_t *grid, const size_t row,
+                          const size_t column);
+
+/* Set the candidates of a cell */
+void grid_set_colors (grid_t *grid, const size_t row, const size_t column,
+                      const colors_t colors);
+
 /* Check if the grid is solved */
 bool grid_is_solved (grid_t *grid);
 
 /* Check if grid is consistent */
 bool grid_is_consistent (grid_t *grid);
 
+/* Check that cells, the colors 1 to size of a grid row by row, are a
+   solved grid, and that they keep clues, 0 for an empty cell, unless NULL.
+   Only bitwise tests on the units, for large sets of results. */
+bool grid_verify (const uint8_t cells[], const size_t size,
+                  const uint8_t clues[]);
+
 /* Apply heuristics and get consistency */
 size_t grid_heuristics(grid_t *grid);
 
+/* Propagate the grids of size GRID_PARALLEL_SIZE and more on threads:
+   the calling thread and threads - 1 persistent ones, all the rows, then
+   all the columns, then all the boxes in parallel. The pool serves one
+   grid at a time. 1 (the default) stops them. Not to be called during a
+   propagation, false if the threads could not be started. */
+bool grid_set_threads (const size_t threads);
+
 /* Free the memory of choice_t */
 void grid_choice_free (choice_t *choice);
 
@@ -73,14 +141,53 @@ void grid_choice_blank (grid_t *grid, const choice_t *choice);
 /* Discard a choice from the grid */
 void grid_choice_discard (grid_t *grid, const choice_t *choice);
 
+/* Check if discarding the choice leaves a single color in its cell */
+bool grid_choice_is_last (const grid_t *grid, const choice_t *choice);
+
 /* Describe the choice in file descriptor */
 void grid_choice_print (const choice_t *choice, FILE *fd);
 
 /* Generate a choice */
 choice_t *grid_choice (grid_t *grid, bool random);
 
+/* Generate a choice, its color is drawn with the PRNG state seed
+   (reentrant), or is the leftmost one if seed is NULL */
+choice_t *grid_choice_r (grid_t *grid, uint64_t *seed);
+
+/* Bytes of a choice, for choices kept in the storage of the caller */
+size_t grid_choice_sizeof (void);
+
+/* Same as grid_choice_r() in the storage of choice, grid_choice_sizeof()
+   bytes suitably aligned, without allocating */
+void grid_choice_into (grid_t *grid, uint64_t *seed, choice_t *choice);
+
 /* Randomly fill the first row.
    PRNG need to be initialized with srand() before calling this function */
 void grid_initialize (grid_t *grid);
 
+/* Randomly fill the first row with the PRNG state seed (reentrant) */
+void grid_initialize_r (grid_t *grid, uint64_t *seed);
+
+/* Save the cells that are not singletons: their positions (row * size +
+   column) in cells, their colors in colors, and return their number. The
+   arrays hold up to size * size cells. Singletons never change, so these
+   cells are enough to undo the changes made to the grid afterwards. */
+size_t grid_snapshot (const grid_t *grid, uint16_t *cells, colors_t *colors);
+
+/* Keep only the count saved cells that the grid changed since, and return
+   their number */
+size_t grid_changes (const grid_t *grid, uint16_t *cells, colors_t *colors,
+                     const size_t count);
+
+/* Write back count saved cells, last saved first so that the oldest color
+   of a cell saved several times is the one left */
+void grid_restore (grid_t *grid, const uint16_t *cells,
+                   const colors_t *colors, const size_t count);
+
+/* Fill the whole grid with a random solution without searching: a valid
+   pattern shuffled by the symmetries of the grid (relabeling of the colors,
+   permutations of bands, stacks, and of the lines inside them,
+   transposition) with the PRNG state seed */
+void grid_fill_r (grid_t *grid, uint64_t *seed);
+
 #endif /* GRID_H */
@@ -0,0 +1,65 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "grid.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* Interactive session on a puzzle: the player sets and clears cells one
+   move at a time, and the candidates of every cell are kept up to date by
+   only going through the row, the column and the box of the move. The
+   candidates of a cell are the colors that no clue or cell set in its units
+   holds, so that clearing a cell gives back exactly what setting it took.
+   Hints look for the next cell the subgrid techniques can deduce. */
+typedef struct session_t session_t;
+
+/* Outcome of a move or of a hint */
+typedef enum
+{
+  SESSION_OK,
+  SESSION_INVALID,   /* no such cell or color */
+  SESSION_CLUE,      /* the cell is a clue of the puzzle */
+  SESSION_CONFLICT,  /* the color is already in a unit of the cell, or a
+                        cell is left without candidate */
+  SESSION_STUCK,     /* the techniques can't deduce any cell */
+  SESSION_SOLVED     /* every cell is filled */
+} session_status_t;
+
+/* Next deducible cell, colors and indexes start from 0 */
+typedef struct
+{
+  size_t row;
+  size_t column;
+  size_t color;
+  const char *technique;  /* subgrid technique that gives the cell, or
+                             "naked_single" for a cell whose units leave
+                             it a single candidate */
+  const char *unit;       /* "row", "column" or "box" where it applies,
+                             NULL for a naked single */
+  size_t index;           /* index of the unit, boxes row by row */
+} hint_t;
+
+/* Open a session on a puzzle, whose singletons are the clues. NULL if two
+   clues conflict or out of memory. */
+session_t *session_new (const grid_t *puzzle);
+
+/* Free the session */
+void session_free (session_t *session);
+
+/* Candidates of the cells, owned by the session */
+const grid_t *session_get_grid (const session_t *session);
+
+/* Set a cell to a color, replacing its previous color if any */
+session_status_t session_set (session_t *session, const size_t row,
+                              const size_t column, const size_t color);
+
+/* Clear a cell set by the player */
+session_status_t session_clear (session_t *session, const size_t row,
+                                const size_t column);
+
+/* Find the next cell deduced from the candidates, the session is left
+   untouched. SESSION_OK fills hint. */
+session_status_t session_hint (const session_t *session, hint_t *hint);
+
+#endif /* SESSION_H */
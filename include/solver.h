@@ -0,0 +1,184 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include "cache.h"
+#include "store.h"
+#include "grid.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Rate of cells emptied by the generator */
+#define EMPTY_RATE 0.4
+
+/* Most threads of a portfolio, see solver_set_portfolio() */
+#define SOLVER_MAX_PORTFOLIO 256
+
+/* Search modes: stop at the first solution, enumerate all of them, stop
+   as soon as a second solution proves the grid is not unique, or only count
+   the solutions without reporting them */
+typedef enum { mode_first, mode_all, mode_unique, mode_count } solver_mode_t;
+
+/* Outcome of a search */
+typedef enum
+{
+  SOLVER_SOLVED,        /* at least one solution was found */
+  SOLVER_UNSOLVABLE,    /* the grid has no solution */
+  SOLVER_OUT_OF_MEMORY, /* the memory limit was reached, search aborted */
+  SOLVER_UNKNOWN        /* the time or node budget was exceeded, or the
+                           search was cancelled: the result is incomplete */
+} solver_status_t;
+
+/* Solver context, all the state of a search lives in it so that several
+   contexts can be used at the same time from different threads */
+typedef struct solver_t solver_t;
+
+/* Called on each solution, the grid is only valid during the call.
+   Return false to stop the search. */
+typedef bool (*solver_callback_t) (const grid_t *solution, void *data);
+
+/* Called periodically during a search with the solutions found and the
+   search nodes visited so far */
+typedef void (*solver_progress_t) (size_t solutions, size_t nodes, void *data);
+
+/* Create a context: mode_first, leftmost choices, no memory limit */
+solver_t *solver_new (void);
+
+/* Free the context and every grid it owns */
+void solver_free (solver_t *solver);
+
+/* Set the search mode */
+void solver_set_mode (solver_t *solver, const solver_mode_t mode);
+
+/* Choose the color of each choice randomly instead of the leftmost one */
+void solver_set_random (solver_t *solver, const bool random);
+
+/* Seed the PRNG of the context, used by random choices and the generator */
+void solver_set_seed (solver_t *solver, const uint64_t seed);
+
+/* Set the function called on each solution, NULL to disable it */
+void solver_set_callback (solver_t *solver, solver_callback_t callback,
+                          void *data);
+
+/* Set the function called every interval search nodes, NULL to disable it */
+void solver_set_progress (solver_t *solver, solver_progress_t progress,
+                          const size_t interval, void *data);
+
+/* Look results up in the cache before searching, and record them in it.
+   NULL to disable it. The cache is not owned by the context. Grids with
+   cells restricted to some candidates bypass it, its keys only hold the
+   singletons. */
+void solver_set_cache (solver_t *solver, cache_t *cache);
+
+/* Same as solver_set_cache() with a persistent store, looked up after the
+   cache. It is only used for grids of its size. */
+void solver_set_store (solver_t *solver, store_t *store);
+
+/* Bound the memory taken by the search in bytes, 0 for no limit */
+void solver_set_memory_limit (solver_t *solver, const size_t bytes);
+
+/* Bound the time of each grid solved or generated in milliseconds,
+   0 for no limit */
+void solver_set_timeout (solver_t *solver, const size_t milliseconds);
+
+/* Bound the search nodes of each grid solved or generated, 0 for no limit */
+void solver_set_max_nodes (solver_t *solver, const size_t nodes);
+
+/* Stop the search as soon as the flag is set, possibly from another thread.
+   The flag may be shared by several contexts, NULL to disable it. */
+void solver_set_cancel (solver_t *solver, atomic_bool *cancel);
+
+/* In mode_first with random choices, cut the search and start it over with
+   new choices after a number of nodes that follows the Luby sequence */
+void solver_set_restarts (solver_t *solver, const bool restarts);
+
+/* In mode_first, race the context configuration against threads - 1
+   randomly seeded copies of it: the first one to settle the grid wins and
+   the others are cancelled. 1 (the default) searches on the calling
+   thread, more than SOLVER_MAX_PORTFOLIO are taken as that many. */
+void solver_set_portfolio (solver_t *solver, const size_t threads);
+
+/* Search the solutions of a grid, the grid is left untouched */
+solver_status_t solver_solve (solver_t *solver, const grid_t *grid);
+
+/* Iterate over the solutions of a grid on demand: solver_start() sets the
+   grid up, each call of solver_next() resumes the search up to the next
+   solution and solver_stop() ends it at any point. The mode, the cache and
+   the portfolio are not used, and any other search on the context ends the
+   iteration. False if out of memory. */
+bool solver_start (solver_t *solver, const grid_t *grid);
+
+/* Next solution of the iteration, owned by the context and only valid
+   until the next call, or NULL. status, unless NULL, tells why:
+   SOLVER_SOLVED with a solution, SOLVER_UNSOLVABLE once every solution was
+   given, SOLVER_OUT_OF_MEMORY, or SOLVER_UNKNOWN when the search is
+   interrupted by a budget, which is renewed for each call: calling it
+   again resumes the search. solver_get_solutions() and solver_get_nodes()
+   count the solutions given and the nodes visited. */
+const grid_t *solver_next (solver_t *solver, solver_status_t *status);
+
+/* End the iteration, SOLVER_UNKNOWN if the last solver_next() was
+   interrupted, SOLVER_UNSOLVABLE if no solution was given */
+solver_status_t solver_stop (solver_t *solver);
+
+/* Split the search of a grid into independent work units: the decision
+   procedure is run down to depth decisions, each one fixing a cell of the
+   fewest candidates to one of them, and unit is called on every subtree
+   still open there, and on every solution found above. A unit is the grid
+   with its decisions added as clues, only valid during the call, and the
+   solutions of all the units are exactly those of the grid. unit returns
+   false to stop. solver_get_solutions() gives the number of units. The
+   time and node budgets and the cancel flag bound the split, which then
+   ends with SOLVER_UNKNOWN and only part of the units. */
+solver_status_t solver_split (solver_t *solver, const grid_t *grid,
+                              const size_t depth, solver_callback_t unit,
+                              void *data);
+
+/* Estimate of a number of solutions, in log10 since large grids have far
+   more than a double holds */
+typedef struct
+{
+  size_t probes;       /* probes run */
+  size_t hits;         /* probes that reached a solution */
+  double log10_count;  /* the estimate, -INFINITY without hits */
+  double log10_low;    /* bounds of its 95% confidence interval */
+  double log10_high;
+} solver_estimate_t;
+
+/* Estimate the number of solutions of a grid with Knuth's random probes:
+   each one goes down the search tree with propagation, picking a random
+   candidate of the cell of fewest candidates, and weighs the leaf it
+   reaches by the product of the branching factors, 0 for a contradiction.
+   The mean weight is an unbiased estimate of the number of solutions.
+   Probes run up to their number, 0 for no limit, and within the time and
+   node budgets of the context, one of them being needed. SOLVER_UNKNOWN
+   if no probe reached a solution. */
+solver_status_t solver_estimate (solver_t *solver, const grid_t *grid,
+                                 const size_t probes,
+                                 solver_estimate_t *estimate);
+
+/* Number of solutions found by the last search */
+size_t solver_get_solutions (const solver_t *solver);
+
+/* Number of search nodes visited by the last search */
+size_t solver_get_nodes (const solver_t *solver);
+
+/* First solution found by the last search, owned by the context.
+   Always NULL in mode_count. */
+const grid_t *solver_get_solution (const solver_t *solver);
+
+/* Let the generator find its solved grid by a random search instead of
+   shuffling a pattern, slower but not limited to the pattern's classes */
+void solver_set_search_fill (solver_t *solver, const bool search);
+
+/* Generate a grid of the given size, with a unique solution if asked.
+   The caller frees the result with grid_free(). status, unless NULL, gets
+   SOLVER_SOLVED, or SOLVER_UNKNOWN and SOLVER_OUT_OF_MEMORY when the
+   budget or the memory runs out: the grid, if any, then has fewer empty
+   cells than usual, still with a unique solution if asked. */
+grid_t *solver_generate (solver_t *solver, const size_t size,
+                         const bool unique, solver_status_t *status);
+
+#endif /* SOLVER_H */
@@ -0,0 +1,51 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "canon.h"
+#include "grid.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Largest size of the file of a store, in bytes */
+#define STORE_MAX_BYTES (256UL << 20)
+
+/* Largest number of results of a store */
+#define STORE_MAX_SLOTS (1UL << 20)
+
+/* Slots probed from the home slot of a key before giving up */
+#define STORE_PROBES 64
+
+/* Reads of a slot being written before it is skipped */
+#define STORE_SPINS 1000
+
+/* Persistent cache of results in a memory-mapped file, for grids of a
+   single size. It is an open-addressing hash table keyed by the canonical
+   form of the givens, holding the number of solutions and a solution of
+   each grid. Several processes may read and update the same file at the
+   same time: slots are claimed and published with atomic operations,
+   without locks. A slot being written is waited for a while, then
+   skipped: a process that crashes while writing a slot leaves it dead for
+   good, the results of its key are then looked for in the next slots. */
+typedef struct store_t store_t;
+
+/* Open the store at path, created for grids of the given size if it
+   doesn't exist, an existing store keeps the size it was created for */
+store_t *store_open (const char *path, const size_t size);
+
+/* Unmap the store, its content stays in the file */
+void store_close (store_t *store);
+
+/* Get the size of the grids of the store */
+size_t store_get_size (const store_t *store);
+
+/* Look up the result of a grid, see cache_get() */
+bool store_get (store_t *store, const canon_t *canon, size_t *count,
+                grid_t **solution);
+
+/* Record a result, merged with the one already known, see cache_put() */
+void store_put (store_t *store, const canon_t *canon, const size_t count,
+                const grid_t *solution);
+
+#endif /* STORE_H */
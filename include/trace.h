@@ -0,0 +1,67 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Span tracing of the hot paths, built in with make TRACE=1 and enabled
+   at run time by trace_start(). Spans are timed with the TSC, each thread
+   records them in its own ring buffer which keeps the last TRACE_RING_SIZE
+   of them, and trace_stop() writes them all as Chrome trace events, to be
+   opened in chrome://tracing or Perfetto. Without TRACE, spans compile to
+   nothing. */
+
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE (1 << 18)
+#endif
+
+/* Enable tracing, the trace goes to path. False if tracing is not built
+   in, already started, or out of memory. */
+bool trace_start (const char *path);
+
+/* Disable tracing and write the trace, false if it could not be written */
+bool trace_stop (void);
+
+#ifdef TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+typedef struct
+{
+  const char *name;
+  uint64_t start;  /* 0 when tracing is disabled */
+} trace_span_t;
+
+extern bool trace_enabled;
+
+/* Timestamp in TSC ticks, or in nanoseconds without a TSC */
+static inline uint64_t trace_clock (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/* Record a span in the ring buffer of the calling thread */
+void trace_end (trace_span_t *span);
+
+/* Record a span named name from here to the end of the enclosing block */
+#define TRACE_SPAN(name)                                                \
+  __attribute__((cleanup(trace_end))) trace_span_t trace_span =         \
+    { (name), trace_enabled ? trace_clock() : 0 }
+
+#else
+
+#define TRACE_SPAN(name) ((void) 0)
+
+#endif /* TRACE */
+
+#endif /* TRACE_H */
@@ -0,0 +1,520 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "colors.h"
+#include "grid.h"
+#include "solver.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+/* Node budget of a grid enumerated with --all, so that a grid with many
+   solutions can't take the whole run */
+#define ALL_MAX_NODES (1 << 20)
+
+/* Runs of each grid, its latency is the fastest one so that the noise of
+   the machine is mostly left out */
+#define REPEATS 3
+
+/* A difference with the baseline is reported when it is significant, with
+   a two-sided p-value below SIGNIFICANCE, and when the medians are at
+   least MIN_CHANGE apart: with large samples, the test alone also picks up
+   the small drifts of the machine between runs */
+#define SIGNIFICANCE 0.01
+#define MIN_CHANGE 0.05
+
+/* Longest workload or corpus name */
+#define NAME_LENGTH 16
+
+/* Corpus of grids generated from a fixed seed. Hard grids are unique
+   grids emptied further down to a minimal set of clues. Fewer grids are
+   taken on large sizes, count / divisor of them. */
+typedef struct
+{
+  const char *name;
+  size_t size;
+  bool unique;
+  bool minimal;
+  size_t divisor;
+} band_t;
+
+static const band_t bands[] = {
+  { "9x9-easy", 9, true, false, 1 },
+  { "9x9-hard", 9, true, true, 1 },
+  { "9x9-multi", 9, false, false, 1 },
+  { "16x16", 16, false, false, 5 },
+  { "25x25", 25, false, false, 20 }
+};
+
+#define BANDS (sizeof(bands) / sizeof(bands[0]))
+
+/* Latencies of a workload over a corpus, in microseconds, and the peak
+   RSS of the process once it is over */
+typedef struct
+{
+  char workload[NAME_LENGTH];
+  char corpus[NAME_LENGTH];
+  size_t rss;
+  size_t count;
+  double *latencies;
+} row_t;
+
+typedef struct
+{
+  row_t *rows;
+  size_t count;
+  size_t capacity;
+} table_t;
+
+static double clock_microseconds (void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+/* Peak RSS of the process in KB */
+static size_t peak_rss (void)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static int compare_doubles (const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+/* Quantile q of sorted values */
+static double quantile (const double *values, const size_t count,
+                        const double q)
+{
+  if (count == 0)
+    return 0;
+  size_t index = ceil(q * count);
+  return values[(index > 0) ? index - 1 : 0];
+}
+
+static row_t *table_add (table_t *table, const char *workload,
+                         const char *corpus, const size_t count)
+{
+  if (table->count == table->capacity) {
+    size_t capacity = table->capacity ? 2 * table->capacity : 16;
+    row_t *rows = realloc(table->rows, capacity * sizeof(row_t));
+    if (!rows)
+      errx(EXIT_FAILURE, "error: can't allocate the results!");
+    table->rows = rows;
+    table->capacity = capacity;
+  }
+  row_t *row = &table->rows[table->count++];
+  snprintf(row->workload, NAME_LENGTH, "%s", workload);
+  snprintf(row->corpus, NAME_LENGTH, "%s", corpus);
+  row->rss = 0;
+  row->count = count;
+  row->latencies = malloc((count ? count : 1) * sizeof(double));
+  if (!row->latencies)
+    errx(EXIT_FAILURE, "error: can't allocate the results!");
+  return row;
+}
+
+static void table_free (table_t *table)
+{
+  for (size_t i = 0; i < table->count; ++i)
+    free(table->rows[i].latencies);
+  free(table->rows);
+}
+
+static const row_t *table_find (const table_t *table, const char *workload,
+                                const char *corpus)
+{
+  for (size_t i = 0; i < table->count; ++i)
+    if (!strcmp(table->rows[i].workload, workload) &&
+        !strcmp(table->rows[i].corpus, corpus))
+      return &table->rows[i];
+  return NULL;
+}
+
+/* Empty the clues of a unique grid in random order, as long as the grid
+   keeps a single solution */
+static void grid_minimize (solver_t *solver, grid_t *grid, uint64_t *seed)
+{
+  size_t size = grid_get_size(grid);
+  size_t total = size * size;
+  size_t cells[total];
+  for (size_t i = 0; i < total; ++i)
+    cells[i] = i;
+  for (size_t i = total - 1; i > 0; --i) {
+    size_t j = random_next(seed) % (i + 1);
+    size_t temp = cells[i];
+    cells[i] = cells[j];
+    cells[j] = temp;
+  }
+
+  solver_set_mode(solver, mode_unique);
+  for (size_t i = 0; i < total; ++i) {
+    size_t row = cells[i] / size;
+    size_t column = cells[i] % size;
+    colors_t clue = grid_get_colors(grid, row, column);
+    if (!colors_is_singleton(clue))
+      continue;
+    grid_set_cell(grid, row, column, EMPTY_CELL);
+    if (solver_solve(solver, grid) != SOLVER_SOLVED ||
+        solver_get_solutions(solver) != 1)
+      grid_set_colors(grid, row, column, clue);
+  }
+}
+
+/* Grids of a band, the same ones for the same seed */
+static grid_t **corpus_build (const band_t *band, const size_t count,
+                              const uint64_t seed)
+{
+  grid_t **grids = malloc((count ? count : 1) * sizeof(grid_t *));
+  solver_t *solver = solver_new();
+  if (!grids || !solver)
+    errx(EXIT_FAILURE, "error: can't allocate the corpus %s!", band->name);
+
+  uint64_t state = seed;
+  solver_set_seed(solver, seed);
+  for (size_t i = 0; i < count; ++i) {
+    grids[i] = solver_generate(solver, band->size, band->unique, NULL);
+    if (!grids[i])
+      errx(EXIT_FAILURE, "error: can't generate the corpus %s!", band->name);
+    if (band->minimal)
+      grid_minimize(solver, grids[i], &state);
+  }
+  solver_free(solver);
+  return grids;
+}
+
+static void corpus_free (grid_t **grids, const size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+    grid_free(grids[i]);
+  free(grids);
+}
+
+/* Solve each grid of a corpus in a mode, REPEATS times */
+static void run_solve (table_t *table, const char *workload,
+                       const band_t *band, grid_t **grids, const size_t count,
+                       const solver_mode_t mode)
+{
+  row_t *row = table_add(table, workload, band->name, count);
+  solver_t *solver = solver_new();
+  if (!solver)
+    errx(EXIT_FAILURE, "error: can't allocate the solver!");
+  solver_set_mode(solver, mode);
+  if (mode == mode_all)
+    solver_set_max_nodes(solver, ALL_MAX_NODES);
+
+  for (size_t i = 0; i < count; ++i) {
+    row->latencies[i] = INFINITY;
+    for (size_t r = 0; r < REPEATS; ++r) {
+      double start = clock_microseconds();
+      solver_solve(solver, grids[i]);
+      double latency = clock_microseconds() - start;
+      if (latency < row->latencies[i])
+        row->latencies[i] = latency;
+    }
+  }
+  solver_free(solver);
+  row->rss = peak_rss();
+}
+
+/* Generate grids of a band, each one REPEATS times from its own seed */
+static void run_generate (table_t *table, const band_t *band,
+                          const size_t count, const uint64_t seed)
+{
+  row_t *row = table_add(table, "generate", band->name, count);
+  solver_t *solver = solver_new();
+  if (!solver)
+    errx(EXIT_FAILURE, "error: can't allocate the solver!");
+
+  for (size_t i = 0; i < count; ++i) {
+    row->latencies[i] = INFINITY;
+    for (size_t r = 0; r < REPEATS; ++r) {
+      solver_set_seed(solver, seed + i);
+      double start = clock_microseconds();
+      grid_t *grid = solver_generate(solver, band->size, band->unique, NULL);
+      double latency = clock_microseconds() - start;
+      grid_free(grid);
+      if (latency < row->latencies[i])
+        row->latencies[i] = latency;
+    }
+  }
+  solver_free(solver);
+  row->rss = peak_rss();
+}
+
+/* Two-sided p-value of the Mann-Whitney U test between two samples, with
+   the normal approximation corrected for ties */
+static double mann_whitney (const double *x, const size_t n1,
+                            const double *y, const size_t n2)
+{
+  size_t n = n1 + n2;
+  if (n1 == 0 || n2 == 0)
+    return 1;
+
+  /* Indexes below n1 are in the first sample */
+  double *values = malloc(n * sizeof(double));
+  size_t *order = malloc(n * sizeof(size_t));
+  if (!values || !order)
+    errx(EXIT_FAILURE, "error: can't allocate the test!");
+  for (size_t i = 0; i < n1; ++i)
+    values[i] = x[i];
+  for (size_t i = 0; i < n2; ++i)
+    values[n1 + i] = y[i];
+  for (size_t i = 0; i < n; ++i)
+    order[i] = i;
+  /* Insertion sort of the indexes, samples are small */
+  for (size_t i = 1; i < n; ++i)
+    for (size_t j = i; j > 0 && values[order[j - 1]] > values[order[j]]; --j) {
+      size_t temp = order[j];
+      order[j] = order[j - 1];
+      order[j - 1] = temp;
+    }
+
+  double ranks = 0;
+  double ties = 0;
+  for (size_t i = 0; i < n; ) {
+    size_t j = i;
+    while (j < n && values[order[j]] == values[order[i]])
+      ++j;
+    double rank = (i + 1 + j) / 2.0;
+    for (size_t k = i; k < j; ++k)
+      if (order[k] < n1)
+        ranks += rank;
+    double t = j - i;
+    ties += t * t * t - t;
+    i = j;
+  }
+  free(values);
+  free(order);
+
+  double u = ranks - n1 * (n1 + 1) / 2.0;
+  double mean = n1 * n2 / 2.0;
+  double variance = n1 * n2 / 12.0 * ((n + 1) - ties / (n * (n - 1.0)));
+  if (variance <= 0)
+    return 1;
+  double z = fabs(u - mean) / sqrt(variance);
+  return erfc(z / sqrt(2));
+}
+
+static void table_print (table_t *table, const table_t *baseline, FILE *fd)
+{
+  fprintf(fd, "%-9s %-10s %7s %10s %10s %10s %8s", "workload", "corpus",
+          "grids", "grids/s", "p50 ms", "p99 ms", "rss KB");
+  if (baseline)
+    fprintf(fd, " %10s %8s %9s  %s", "base p50", "change", "p-value",
+            "verdict");
+  fputc('\n', fd);
+
+  for (size_t i = 0; i < table->count; ++i) {
+    row_t *row = &table->rows[i];
+    double total = 0;
+    for (size_t k = 0; k < row->count; ++k)
+      total += row->latencies[k];
+    double *sorted = malloc((row->count ? row->count : 1) * sizeof(double));
+    if (!sorted)
+      errx(EXIT_FAILURE, "error: can't allocate the results!");
+    memcpy(sorted, row->latencies, row->count * sizeof(double));
+    qsort(sorted, row->count, sizeof(double), compare_doubles);
+    double p50 = quantile(sorted, row->count, 0.5);
+    fprintf(fd, "%-9s %-10s %7zu %10.1f %10.3f %10.3f %8zu", row->workload,
+            row->corpus, row->count, (total > 0) ? row->count / total * 1e6 : 0,
+            p50 / 1e3, quantile(sorted, row->count, 0.99) / 1e3, row->rss);
+    free(sorted);
+
+    const row_t *base = baseline ?
+      table_find(baseline, row->workload, row->corpus) : NULL;
+    if (base) {
+      double *base_sorted = malloc((base->count ? base->count : 1) *
+                                   sizeof(double));
+      if (!base_sorted)
+        errx(EXIT_FAILURE, "error: can't allocate the results!");
+      memcpy(base_sorted, base->latencies, base->count * sizeof(double));
+      qsort(base_sorted, base->count, sizeof(double), compare_doubles);
+      double base_p50 = quantile(base_sorted, base->count, 0.5);
+      free(base_sorted);
+      double p = mann_whitney(row->latencies, row->count, base->latencies,
+                              base->count);
+      double change = (base_p50 > 0) ? p50 / base_p50 - 1 : 0;
+      const char *verdict = "same";
+      if (p < SIGNIFICANCE && fabs(change) >= MIN_CHANGE)
+        verdict = (change > 0) ? "slower" : "faster";
+      fprintf(fd, " %10.3f %+7.1f%% %9.2g  %s", base_p50 / 1e3, change * 100,
+              p, verdict);
+    }
+    else if (baseline)
+      fprintf(fd, " %10s", "-");
+    fputc('\n', fd);
+  }
+}
+
+/* One line per row: workload, corpus, peak RSS, number of latencies and
+   the latencies in microseconds */
+static bool table_save (const table_t *table, const char *path)
+{
+  FILE *file = fopen(path, "w");
+  if (!file)
+    return false;
+  fprintf(file, "# sudoku benchmark: workload corpus rss-KB count "
+          "latencies-us...\n");
+  for (size_t i = 0; i < table->count; ++i) {
+    const row_t *row = &table->rows[i];
+    fprintf(file, "%s %s %zu %zu", row->workload, row->corpus, row->rss,
+            row->count);
+    for (size_t k = 0; k < row->count; ++k)
+      fprintf(file, " %.3f", row->latencies[k]);
+    fputc('\n', file);
+  }
+  return fclose(file) == 0;
+}
+
+static bool table_load (table_t *table, const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return false;
+
+  bool valid = true;
+  char workload[NAME_LENGTH];
+  char corpus[NAME_LENGTH];
+  size_t rss;
+  size_t count;
+  int c;
+  while (valid && (c = fgetc(file)) != EOF) {
+    if (c == '#' || c == '\n') {
+      while (c != '\n' && c != EOF)
+        c = fgetc(file);
+      continue;
+    }
+    ungetc(c, file);
+    if (fscanf(file, "%15s %15s %zu %zu", workload, corpus, &rss,
+               &count) != 4) {
+      valid = false;
+      break;
+    }
+    row_t *row = table_add(table, workload, corpus, count);
+    row->rss = rss;
+    for (size_t k = 0; k < count && valid; ++k)
+      valid = fscanf(file, "%lf", &row->latencies[k]) == 1;
+  }
+  fclose(file);
+  return valid;
+}
+
+/* Read a decimal number, false unless the whole string is one that fits */
+static bool number_parser (const char *str, unsigned long long *number)
+{
+  if (*str < '0' || *str > '9')
+    return false;
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(str, &end, 10);
+  if (*end != '\0' || errno == ERANGE)
+    return false;
+  *number = value;
+  return true;
+}
+
+int main (int argc, char *argv[])
+{
+  size_t count = 1000;
+  uint64_t seed = 1;
+  unsigned long long number;
+  char *output = NULL;
+  char *baseline_path = NULL;
+  int optc;
+  const struct option longopts[] = {
+    { "count", required_argument, NULL, 'n' },
+    { "seed", required_argument, NULL, 's' },
+    { "output", required_argument, NULL, 'o' },
+    { "baseline", required_argument, NULL, 'b' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  while ((optc = getopt_long(argc, argv, "n:s:o:b:h", longopts, NULL)) != -1)
+    switch (optc)
+    {
+      case 'n':
+        if (!number_parser(optarg, &number) || number == 0 ||
+            number > SIZE_MAX)
+          errx(EXIT_FAILURE, "error: invalid number of grids %s", optarg);
+        count = number;
+        break;
+
+      case 's':
+        if (!number_parser(optarg, &number))
+          errx(EXIT_FAILURE, "error: invalid seed %s", optarg);
+        seed = number;
+        break;
+
+      case 'o':
+        output = optarg;
+        break;
+
+      case 'b':
+        baseline_path = optarg;
+        break;
+
+      case 'h':
+        fputs("Usage: benchmark [-n N | -s SEED | -o FILE | -b FILE | -h]\n"
+              "Solve, enumerate and generate corpora of grids built by the "
+              "generator\n"
+              "from fixed seeds, and compare with the results of a baseline\n"
+              "\n"
+              " -n N, --count N        grids per 9x9 corpus, fewer on larger "
+              "sizes\n"
+              "                        (default: 1000)\n"
+              " -s SEED, --seed SEED   seed of the corpora (default: 1)\n"
+              " -o FILE, --output FILE save the results in FILE\n"
+              " -b FILE, --baseline FILE\n"
+              "                        compare with the results saved in "
+              "FILE\n"
+              " -h, --help             display this help and exit\n", stdout);
+        return EXIT_SUCCESS;
+
+      default:
+        errx(EXIT_FAILURE, "error: invalid option - please check syntax with "
+             "'./benchmark -h'");
+    }
+
+  table_t baseline = { NULL, 0, 0 };
+  if (baseline_path && !table_load(&baseline, baseline_path))
+    errx(EXIT_FAILURE, "error: invalid baseline file %s", baseline_path);
+
+  table_t table = { NULL, 0, 0 };
+  for (size_t b = 0; b < BANDS; ++b) {
+    const band_t *band = &bands[b];
+    size_t grids_count = count / band->divisor;
+    if (grids_count == 0)
+      grids_count = 1;
+    fprintf(stderr, "Corpus %s: %zu grids\n", band->name, grids_count);
+    grid_t **grids = corpus_build(band, grids_count, seed + b);
+    run_solve(&table, "solve", band, grids, grids_count, mode_first);
+    if (band->size == 9)
+      run_solve(&table, "all", band, grids, grids_count, mode_all);
+    corpus_free(grids, grids_count);
+    if (!band->minimal)
+      run_generate(&table, band, grids_count, (seed + b) << 32);
+  }
+
+  table_print(&table, baseline_path ? &baseline : NULL, stdout);
+  if (output && !table_save(&table, output))
+    warnx("error: can't write the results in %s", output);
+  table_free(&table);
+  table_free(&baseline);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,494 @@
+#include "board.h"
+
+#include "colors.h"
+#include "trace.h"
+
+#define CELLS 81
+#define DIGITS 9
+
+/* Set of cells, cell row * 9 + column is bit row * 9 + column */
+__extension__ typedef unsigned __int128 bits_t;
+
+#define BIT(cell) ((bits_t) 1 << (cell))
+
+typedef enum { STATE_OPEN, STATE_SOLVED, STATE_CONTRADICTION } outcome_t;
+
+typedef struct
+{
+  bits_t digits[DIGITS];  /* cells where each digit is still possible */
+  bits_t solved;          /* cells whose digit is placed */
+} state_t;
+
+/* Search node: its state, and the digits of its choice cell left to try */
+typedef struct
+{
+  state_t state;
+  uint8_t cell;
+  uint16_t left;
+  bool fresh;
+} frame_t;
+
+struct board_t
+{
+  bits_t all;
+  bits_t peers[CELLS];
+  bits_t units[27];  /* rows, columns, then boxes */
+  frame_t stack[CELLS + 1];
+  size_t depth;
+  state_t solution;
+};
+
+/* Lowest cell of a set that is not empty */
+static size_t bits_first (const bits_t bits)
+{
+  uint64_t low = (uint64_t) bits;
+  if (low)
+    return __builtin_ctzll(low);
+  return 64 + __builtin_ctzll((uint64_t) (bits >> 64));
+}
+
+static bool bits_is_single (const bits_t bits)
+{
+  return bits && !(bits & (bits - 1));
+}
+
+board_t *board_new (void)
+{
+  board_t *board = malloc(sizeof(board_t));
+  if (!board)
+    return NULL;
+
+  board->all = 0;
+  for (size_t u = 0; u < 27; ++u)
+    board->units[u] = 0;
+  for (size_t cell = 0; cell < CELLS; ++cell) {
+    size_t row = cell / 9;
+    size_t column = cell % 9;
+    size_t box = row / 3 * 3 + column / 3;
+    board->all |= BIT(cell);
+    board->units[row] |= BIT(cell);
+    board->units[9 + column] |= BIT(cell);
+    board->units[18 + box] |= BIT(cell);
+  }
+  for (size_t cell = 0; cell < CELLS; ++cell) {
+    size_t row = cell / 9;
+    size_t column = cell % 9;
+    size_t box = row / 3 * 3 + column / 3;
+    board->peers[cell] = (board->units[row] | board->units[9 + column] |
+                          board->units[18 + box]) & ~BIT(cell);
+  }
+  board->depth = 0;
+  return board;
+}
+
+size_t board_sizeof (void)
+{
+  return sizeof(board_t);
+}
+
+void board_free (board_t *board)
+{
+  free(board);
+}
+
+/* Candidates of a cell, one bit per digit */
+static uint16_t state_cell (const state_t *state, const size_t cell)
+{
+  uint16_t candidates = 0;
+  for (size_t d = 0; d < DIGITS; ++d)
+    if ((state->digits[d] >> cell) & 1)
+      candidates |= 1 << d;
+  return candidates;
+}
+
+static void state_place (const board_t *board, state_t *state,
+                         const size_t cell, const size_t digit)
+{
+  bits_t bit = BIT(cell);
+  for (size_t d = 0; d < DIGITS; ++d)
+    state->digits[d] &= ~bit;
+  state->digits[digit] = (state->digits[digit] & ~board->peers[cell]) | bit;
+  state->solved |= bit;
+}
+
+/* Remove a digit from the cells of a line outside of a box, or the other
+   way around, when the digit is confined to their intersection */
+static bool state_confine (const board_t *board, state_t *state,
+                           const size_t digit, const bits_t unsolved)
+{
+  bool changed = false;
+  bits_t *cells = &state->digits[digit];
+  for (size_t b = 0; b < 9; ++b) {
+    bits_t box = board->units[18 + b];
+    bits_t in_box = *cells & box & unsolved;
+    for (size_t k = 0; k < 3 && in_box; ++k) {
+      bits_t row = board->units[b / 3 * 3 + k];
+      bits_t column = board->units[9 + b % 3 * 3 + k];
+      bits_t in_row = *cells & row & unsolved;
+      bits_t in_column = *cells & column & unsolved;
+      /* Pointing: in the box, only on the line */
+      if (!(in_box & ~row) && (*cells & row & ~box)) {
+        *cells &= ~(row & ~box);
+        changed = true;
+      }
+      if (!(in_box & ~column) && (*cells & column & ~box)) {
+        *cells &= ~(column & ~box);
+        changed = true;
+      }
+      /* Claiming: on the line, only in the box */
+      if (in_row && !(in_row & ~box) && (*cells & box & ~row)) {
+        *cells &= ~(box & ~row);
+        changed = true;
+      }
+      if (in_column && !(in_column & ~box) && (*cells & box & ~column)) {
+        *cells &= ~(box & ~column);
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+/* Apply naked singles, hidden singles and box/line interactions up to a
+   fixed point */
+static outcome_t state_propagate (const board_t *board, state_t *state)
+{
+  TRACE_SPAN("board_propagate");
+  while (true) {
+    bits_t once = 0;
+    bits_t twice = 0;
+    for (size_t d = 0; d < DIGITS; ++d) {
+      twice |= once & state->digits[d];
+      once |= state->digits[d];
+    }
+    bits_t unsolved = board->all & ~state->solved;
+    if (unsolved & ~once)
+      return STATE_CONTRADICTION;
+    if (!unsolved)
+      return STATE_SOLVED;
+
+    /* Naked singles: cells with a single candidate */
+    bits_t singles = unsolved & ~twice;
+    if (singles) {
+      while (singles) {
+        size_t cell = bits_first(singles);
+        singles &= singles - 1;
+        uint16_t candidates = state_cell(state, cell);
+        /* Taken by an earlier single of the same unit */
+        if (!candidates)
+          return STATE_CONTRADICTION;
+        state_place(board, state, cell, __builtin_ctz(candidates));
+      }
+      continue;
+    }
+
+    /* Hidden singles: digits with a single cell in a unit */
+    bool placed = false;
+    for (size_t d = 0; d < DIGITS; ++d)
+      for (size_t u = 0; u < 27; ++u) {
+        bits_t cells = state->digits[d] & board->units[u];
+        if (!cells)
+          return STATE_CONTRADICTION;
+        if (bits_is_single(cells) && (cells & ~state->solved)) {
+          state_place(board, state, bits_first(cells), d);
+          placed = true;
+        }
+      }
+    if (placed)
+      continue;
+
+    bool changed = false;
+    for (size_t d = 0; d < DIGITS; ++d)
+      changed |= state_confine(board, state, d, unsolved);
+    if (!changed)
+      return STATE_OPEN;
+  }
+}
+
+/* Unsolved cell with the fewest candidates, the candidates in candidates */
+static size_t state_choose (const board_t *board, const state_t *state,
+                            uint16_t *candidates)
+{
+  bits_t once = 0;
+  bits_t twice = 0;
+  bits_t thrice = 0;
+  for (size_t d = 0; d < DIGITS; ++d) {
+    thrice |= twice & state->digits[d];
+    twice |= once & state->digits[d];
+    once |= state->digits[d];
+  }
+  bits_t unsolved = board->all & ~state->solved;
+  bits_t pairs = unsolved & twice & ~thrice;
+  if (pairs) {
+    size_t cell = bits_first(pairs);
+    *candidates = state_cell(state, cell);
+    return cell;
+  }
+
+  size_t best = CELLS;
+  size_t best_count = DIGITS + 1;
+  for (bits_t cells = unsolved; cells; cells &= cells - 1) {
+    size_t cell = bits_first(cells);
+    uint16_t cell_candidates = state_cell(state, cell);
+    size_t count = __builtin_popcount(cell_candidates);
+    if (count < best_count) {
+      best = cell;
+      best_count = count;
+      *candidates = cell_candidates;
+    }
+  }
+  return best;
+}
+
+bool board_load (board_t *board, const grid_t *grid)
+{
+  if (grid_get_size(grid) != 9)
+    return false;
+
+  state_t *state = &board->stack[0].state;
+  for (size_t d = 0; d < DIGITS; ++d)
+    state->digits[d] = 0;
+  state->solved = 0;
+  for (size_t cell = 0; cell < CELLS; ++cell) {
+    colors_t colors = grid_get_colors(grid, cell / 9, cell % 9);
+    for (size_t d = 0; d < DIGITS; ++d)
+      if (colors_is_in(colors, d))
+        state->digits[d] |= BIT(cell);
+  }
+  board->stack[0].fresh = true;
+  board->depth = 1;
+  return true;
+}
+
+board_status_t board_next (board_t *board, uint64_t *seed,
+                           board_node_t node, void *data)
+{
+  while (board->depth > 0) {
+    frame_t *frame = &board->stack[board->depth - 1];
+    if (frame->fresh) {
+      if (node && !node(data))
+        return BOARD_STOPPED;
+      frame->fresh = false;
+      outcome_t outcome = state_propagate(board, &frame->state);
+      if (outcome == STATE_CONTRADICTION) {
+        --board->depth;
+        continue;
+      }
+      if (outcome == STATE_SOLVED) {
+        board->solution = frame->state;
+        --board->depth;
+        return BOARD_SOLVED;
+      }
+      frame->cell = state_choose(board, &frame->state, &frame->left);
+    }
+    if (!frame->left) {
+      --board->depth;
+      continue;
+    }
+
+    uint16_t left = frame->left;
+    if (seed)
+      for (size_t k = random_next(seed) % __builtin_popcount(left); k > 0; --k)
+        left &= left - 1;
+    size_t digit = __builtin_ctz(left);
+    frame->left &= ~(1 << digit);
+
+    /* The last digit of the cell is tried in place, without a copy */
+    if (!frame->left) {
+      state_place(board, &frame->state, frame->cell, digit);
+      frame->fresh = true;
+      continue;
+    }
+    frame_t *child = &board->stack[board->depth++];
+    child->state = frame->state;
+    state_place(board, &child->state, frame->cell, digit);
+    child->fresh = true;
+  }
+  return BOARD_EXHAUSTED;
+}
+
+void board_solution (const board_t *board, grid_t *grid)
+{
+  for (size_t cell = 0; cell < CELLS; ++cell)
+    for (size_t d = 0; d < DIGITS; ++d)
+      if ((board->solution.digits[d] >> cell) & 1)
+        grid_set_colors(grid, cell / 9, cell % 9, colors_set(d));
+}
+
+/* Candidate sets of BOARD_LANES grids, one per lane */
+typedef uint16_t lanes_t __attribute__((vector_size(2 * BOARD_LANES)));
+
+/* Cells of the rows, the columns, then the boxes */
+static const uint8_t unit_cells[27][9] = {
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8 },
+  {  9, 10, 11, 12, 13, 14, 15, 16, 17 },
+  { 18, 19, 20, 21, 22, 23, 24, 25, 26 },
+  { 27, 28, 29, 30, 31, 32, 33, 34, 35 },
+  { 36, 37, 38, 39, 40, 41, 42, 43, 44 },
+  { 45, 46, 47, 48, 49, 50, 51, 52, 53 },
+  { 54, 55, 56, 57, 58, 59, 60, 61, 62 },
+  { 63, 64, 65, 66, 67, 68, 69, 70, 71 },
+  { 72, 73, 74, 75, 76, 77, 78, 79, 80 },
+  {  0,  9, 18, 27, 36, 45, 54, 63, 72 },
+  {  1, 10, 19, 28, 37, 46, 55, 64, 73 },
+  {  2, 11, 20, 29, 38, 47, 56, 65, 74 },
+  {  3, 12, 21, 30, 39, 48, 57, 66, 75 },
+  {  4, 13, 22, 31, 40, 49, 58, 67, 76 },
+  {  5, 14, 23, 32, 41, 50, 59, 68, 77 },
+  {  6, 15, 24, 33, 42, 51, 60, 69, 78 },
+  {  7, 16, 25, 34, 43, 52, 61, 70, 79 },
+  {  8, 17, 26, 35, 44, 53, 62, 71, 80 },
+  {  0,  1,  2,  9, 10, 11, 18, 19, 20 },
+  {  3,  4,  5, 12, 13, 14, 21, 22, 23 },
+  {  6,  7,  8, 15, 16, 17, 24, 25, 26 },
+  { 27, 28, 29, 36, 37, 38, 45, 46, 47 },
+  { 30, 31, 32, 39, 40, 41, 48, 49, 50 },
+  { 33, 34, 35, 42, 43, 44, 51, 52, 53 },
+  { 54, 55, 56, 63, 64, 65, 72, 73, 74 },
+  { 57, 58, 59, 66, 67, 68, 75, 76, 77 },
+  { 60, 61, 62, 69, 70, 71, 78, 79, 80 }
+};
+
+/* Naked and hidden singles on every lane up to a fixed point, failed gets
+   the lanes that reached a contradiction. Built for AVX-512 (x86-64-v4),
+   AVX2 (x86-64-v3) and the baseline, the loader picks one for the
+   processor. */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+__attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#endif
+static void lanes_propagate (lanes_t cells[CELLS], lanes_t *failed)
+{
+  const lanes_t zero = { 0 };
+  const lanes_t full = zero + ((1 << DIGITS) - 1);
+  lanes_t bad = zero;
+  bool changed = true;
+  while (changed) {
+    lanes_t change = zero;
+    for (size_t u = 0; u < 27; ++u) {
+      const uint8_t *unit = unit_cells[u];
+
+      /* Naked singles: their digits leave the other cells of the unit */
+      lanes_t placed = zero;
+      for (size_t k = 0; k < 9; ++k) {
+        lanes_t m = cells[unit[k]];
+        lanes_t single = m & (lanes_t) ((m & (m - 1)) == zero);
+        bad |= (lanes_t) (m == zero) | (lanes_t) ((placed & single) != zero);
+        placed |= single;
+      }
+      lanes_t once = zero;
+      lanes_t twice = zero;
+      for (size_t k = 0; k < 9; ++k) {
+        lanes_t m = cells[unit[k]];
+        lanes_t multiple = (lanes_t) ((m & (m - 1)) != zero);
+        lanes_t left = m & ~(placed & multiple);
+        change |= left ^ m;
+        cells[unit[k]] = left;
+        twice |= once & left;
+        once |= left;
+      }
+
+      /* Hidden singles: digits left in a single cell of the unit, two of
+         them in the same cell is a contradiction */
+      bad |= (lanes_t) (once != full);
+      lanes_t lone = once & ~twice;
+      for (size_t k = 0; k < 9; ++k) {
+        lanes_t m = cells[unit[k]];
+        lanes_t only = m & lone;
+        lanes_t take = (lanes_t) (only != zero) &
+                       (lanes_t) ((m & (m - 1)) != zero);
+        bad |= (lanes_t) ((only & (only - 1)) != zero);
+        lanes_t left = m ^ ((m ^ only) & take);
+        change |= left ^ m;
+        cells[unit[k]] = left;
+      }
+    }
+
+    /* Lanes at a contradiction don't keep the others going */
+    change &= ~bad;
+    changed = false;
+    for (size_t l = 0; l < BOARD_LANES; ++l)
+      changed |= change[l] != 0;
+  }
+  *failed = bad;
+}
+
+/* Candidates of a cell, one bit per digit */
+static uint16_t colors_digits (const colors_t colors)
+{
+  if (colors_is_singleton(colors))
+    return 1 << colors_index(colors);
+  uint16_t digits = 0;
+  for (size_t d = 0; d < DIGITS; ++d)
+    if (colors_is_in(colors, d))
+      digits |= 1 << d;
+  return digits;
+}
+
+static colors_t digits_colors (const uint16_t digits)
+{
+  if (!(digits & (digits - 1)))
+    return digits ? colors_set(__builtin_ctz(digits)) : colors_empty();
+  colors_t colors = colors_empty();
+  for (size_t d = 0; d < DIGITS; ++d)
+    if ((digits >> d) & 1)
+      colors = colors_add(colors, d);
+  return colors;
+}
+
+void board_heuristics (grid_t *grids[], const size_t count, size_t results[])
+{
+  TRACE_SPAN("board_heuristics");
+  const lanes_t all = (lanes_t) { 0 } + ((1 << DIGITS) - 1);
+  const colors_t full = colors_full(DIGITS);
+  lanes_t cells[CELLS];
+  lanes_t loaded[CELLS];
+  for (size_t first = 0; first < count; first += BOARD_LANES) {
+    size_t lanes = count - first;
+    if (lanes > BOARD_LANES)
+      lanes = BOARD_LANES;
+
+    /* Lanes without a 9x9 grid have every candidate, they never change */
+    for (size_t cell = 0; cell < CELLS; ++cell)
+      cells[cell] = all;
+    for (size_t l = 0; l < lanes; ++l) {
+      const grid_t *grid = grids[first + l];
+      if (!grid || grid_get_size(grid) != 9)
+        continue;
+      for (size_t cell = 0; cell < CELLS; ++cell) {
+        colors_t colors = grid_get_colors(grid, cell / 9, cell % 9);
+        if (!colors_is_equal(colors, full))
+          cells[cell][l] = colors_digits(colors);
+      }
+    }
+    for (size_t cell = 0; cell < CELLS; ++cell)
+      loaded[cell] = cells[cell];
+
+    lanes_t failed;
+    lanes_propagate(cells, &failed);
+
+    for (size_t l = 0; l < lanes; ++l) {
+      grid_t *grid = grids[first + l];
+      size_t *result = &results[first + l];
+      if (!grid) {
+        *result = NOT_CONSISTENT;
+        continue;
+      }
+      if (grid_get_size(grid) != 9) {
+        *result = CONSISTENT_NOT_SOLVED;
+        continue;
+      }
+      if (failed[l]) {
+        *result = NOT_CONSISTENT;
+        continue;
+      }
+      bool solved = true;
+      for (size_t cell = 0; cell < CELLS; ++cell) {
+        uint16_t digits = cells[cell][l];
+        solved &= !(digits & (digits - 1));
+        if (digits != loaded[cell][l])
+          grid_set_colors(grid, cell / 9, cell % 9, digits_colors(digits));
+      }
+      *result = solved ? SOLVED : CONSISTENT_NOT_SOLVED;
+    }
+  }
+}
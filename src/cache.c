@@ -0,0 +1,196 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+
+#include <pthread.h>
+#include <string.h>
+
+typedef struct entry_t entry_t;
+
+struct entry_t
+{
+  entry_t *next;        /* next entry of the bucket */
+  entry_t *newer;       /* neighbours in the use order */
+  entry_t *older;
+  uint64_t hash;
+  size_t size;
+  size_t count;
+  unsigned char *solution;
+  unsigned char key[];
+};
+
+struct cache_t
+{
+  pthread_mutex_t lock;
+  size_t capacity;
+  size_t entries;
+  size_t mask;
+  entry_t **buckets;
+  entry_t *newest;
+  entry_t *oldest;
+};
+
+cache_t *cache_new (const size_t capacity)
+{
+  /* Twice as many buckets as results, a power of 2 that must not wrap */
+  if (capacity == 0 || capacity > SIZE_MAX / 4)
+    return NULL;
+
+  cache_t *cache = malloc(sizeof(cache_t));
+  if (!cache)
+    return NULL;
+
+  size_t buckets = 1;
+  while (buckets < 2 * capacity)
+    buckets <<= 1;
+  cache->buckets = calloc(buckets, sizeof(entry_t *));
+  if (!cache->buckets) {
+    free(cache);
+    return NULL;
+  }
+  pthread_mutex_init(&cache->lock, NULL);
+  cache->capacity = capacity;
+  cache->entries = 0;
+  cache->mask = buckets - 1;
+  cache->newest = NULL;
+  cache->oldest = NULL;
+  return cache;
+}
+
+static void entry_free (entry_t *entry)
+{
+  free(entry->solution);
+  free(entry);
+}
+
+void cache_free (cache_t *cache)
+{
+  if (!cache)
+    return;
+
+  entry_t *entry = cache->newest;
+  while (entry) {
+    entry_t *older = entry->older;
+    entry_free(entry);
+    entry = older;
+  }
+  pthread_mutex_destroy(&cache->lock);
+  free(cache->buckets);
+  free(cache);
+}
+
+static void cache_unlink (cache_t *cache, entry_t *entry)
+{
+  if (entry->newer)
+    entry->newer->older = entry->older;
+  else
+    cache->newest = entry->older;
+  if (entry->older)
+    entry->older->newer = entry->newer;
+  else
+    cache->oldest = entry->newer;
+}
+
+static void cache_touch (cache_t *cache, entry_t *entry)
+{
+  entry->newer = NULL;
+  entry->older = cache->newest;
+  if (cache->newest)
+    cache->newest->newer = entry;
+  else
+    cache->oldest = entry;
+  cache->newest = entry;
+}
+
+static entry_t *cache_find (cache_t *cache, const canon_t *canon)
+{
+  size_t size = canon_get_size(canon);
+  uint64_t hash = canon_hash(canon);
+  entry_t *entry = cache->buckets[hash & cache->mask];
+  while (entry) {
+    if (entry->hash == hash && entry->size == size &&
+        !memcmp(entry->key, canon_get_key(canon), size * size))
+      return entry;
+    entry = entry->next;
+  }
+  return NULL;
+}
+
+/* Drop the least recently used entry */
+static void cache_evict (cache_t *cache)
+{
+  entry_t *entry = cache->oldest;
+  if (!entry)
+    return;
+
+  cache_unlink(cache, entry);
+  entry_t **link = &cache->buckets[entry->hash & cache->mask];
+  while (*link != entry)
+    link = &(*link)->next;
+  *link = entry->next;
+  entry_free(entry);
+  --cache->entries;
+}
+
+bool cache_get (cache_t *cache, const canon_t *canon, size_t *count,
+                grid_t **solution)
+{
+  pthread_mutex_lock(&cache->lock);
+  entry_t *entry = cache_find(cache, canon);
+  if (!entry) {
+    pthread_mutex_unlock(&cache->lock);
+    return false;
+  }
+  cache_unlink(cache, entry);
+  cache_touch(cache, entry);
+  *count = entry->count;
+  *solution = NULL;
+  if (entry->solution)
+    *solution = canon_decode(canon, entry->solution);
+  pthread_mutex_unlock(&cache->lock);
+  return true;
+}
+
+void cache_put (cache_t *cache, const canon_t *canon, const size_t count,
+                const grid_t *solution)
+{
+  size_t size = canon_get_size(canon);
+  unsigned char *cells = NULL;
+  if (solution) {
+    cells = malloc(size * size);
+    if (cells)
+      canon_encode(canon, solution, cells);
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  entry_t *entry = cache_find(cache, canon);
+  if (entry)
+    cache_unlink(cache, entry);
+  else {
+    entry = malloc(sizeof(entry_t) + size * size);
+    if (!entry) {
+      pthread_mutex_unlock(&cache->lock);
+      free(cells);
+      return;
+    }
+    if (cache->entries == cache->capacity)
+      cache_evict(cache);
+    entry->hash = canon_hash(canon);
+    entry->size = size;
+    entry->count = CACHE_UNKNOWN;
+    entry->solution = NULL;
+    memcpy(entry->key, canon_get_key(canon), size * size);
+    entry->next = cache->buckets[entry->hash & cache->mask];
+    cache->buckets[entry->hash & cache->mask] = entry;
+    ++cache->entries;
+  }
+  if (count != CACHE_UNKNOWN)
+    entry->count = count;
+  if (cells && !entry->solution) {
+    entry->solution = cells;
+    cells = NULL;
+  }
+  cache_touch(cache, entry);
+  pthread_mutex_unlock(&cache->lock);
+  free(cells);
+}
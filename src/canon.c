@@ -0,0 +1,404 @@
+#include "canon.h"
+
+#include "colors.h"
+
+#include <string.h>
+
+struct canon_t
+{
+  size_t size;
+  bool transpose;
+  size_t rows[MAX_GRID_SIZE];
+  size_t columns[MAX_GRID_SIZE];
+  size_t colors[MAX_COLORS];
+  uint64_t hash;
+  unsigned char key[];
+};
+
+/* Orderings of the rows and the columns of one orientation of the grid:
+   final line i is blocks[i / b] * b + lines[blocks[i / b] * b + i % b] */
+typedef struct
+{
+  size_t *blocks;
+  size_t *lines;
+} order_t;
+
+/* Run of lines or blocks that have the same invariants */
+typedef struct
+{
+  size_t *values;
+  size_t length;
+} segment_t;
+
+/* State of the search of the smallest key */
+typedef struct
+{
+  size_t size;
+  size_t block;
+  const int *cells;
+  const size_t *frequency;
+  bool transpose;
+  size_t row_blocks[MAX_GRID_SIZE];
+  size_t row_lines[MAX_GRID_SIZE];
+  size_t column_blocks[MAX_GRID_SIZE];
+  size_t column_lines[MAX_GRID_SIZE];
+  segment_t segments[4 * MAX_GRID_SIZE];
+  size_t segments_count;
+  unsigned char *candidate;
+  bool found;
+} search_t;
+
+static uint64_t hash_mix (uint64_t hash, const uint64_t value)
+{
+  hash ^= value + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+static void sort_values (uint64_t *values, const size_t length)
+{
+  for (size_t i = 1; i < length; ++i) {
+    uint64_t value = values[i];
+    size_t j = i;
+    while (j > 0 && values[j - 1] > value) {
+      values[j] = values[j - 1];
+      --j;
+    }
+    values[j] = value;
+  }
+}
+
+/* Stable sort of indices by their signatures */
+static void sort_indices (size_t *indices, const size_t length,
+                          const uint64_t *signatures)
+{
+  for (size_t i = 1; i < length; ++i) {
+    size_t index = indices[i];
+    size_t j = i;
+    while (j > 0 && signatures[indices[j - 1]] > signatures[index]) {
+      indices[j] = indices[j - 1];
+      --j;
+    }
+    indices[j] = index;
+  }
+}
+
+static bool permutation_next (size_t *values, const size_t length)
+{
+  if (length < 2)
+    return false;
+
+  size_t i = length - 1;
+  while (i > 0 && values[i - 1] >= values[i])
+    --i;
+  if (i > 0) {
+    size_t j = length - 1;
+    while (values[j] <= values[i - 1])
+      --j;
+    size_t temp = values[i - 1];
+    values[i - 1] = values[j];
+    values[j] = temp;
+  }
+  for (size_t k = i, l = length - 1; k < l; ++k, --l) {
+    size_t temp = values[k];
+    values[k] = values[l];
+    values[l] = temp;
+  }
+  return i > 0;
+}
+
+/* Color of a cell of the current orientation, -1 if empty */
+static int search_cell (const search_t *search, const size_t row,
+                        const size_t column)
+{
+  if (search->transpose)
+    return search->cells[column * search->size + row];
+  return search->cells[row * search->size + column];
+}
+
+/* Invariant of a line under the symmetries that keep it a line */
+static uint64_t line_signature (const search_t *search, const size_t line,
+                                const bool column)
+{
+  uint64_t blocks[MAX_GRID_SIZE] = { 0 };
+  uint64_t frequency[MAX_GRID_SIZE];
+  size_t count = 0;
+  for (size_t k = 0; k < search->size; ++k) {
+    int color = column ? search_cell(search, k, line) :
+                         search_cell(search, line, k);
+    if (color < 0)
+      continue;
+    ++blocks[k / search->block];
+    frequency[count++] = search->frequency[color];
+  }
+  sort_values(blocks, search->block);
+  sort_values(frequency, count);
+
+  uint64_t hash = hash_mix(0, count);
+  for (size_t k = 0; k < search->block; ++k)
+    hash = hash_mix(hash, blocks[k]);
+  for (size_t k = 0; k < count; ++k)
+    hash = hash_mix(hash, frequency[k]);
+  return hash;
+}
+
+/* Record the runs of equal signatures of a sorted array of indices */
+static void search_segments (search_t *search, size_t *indices,
+                             const size_t length, const uint64_t *signatures)
+{
+  size_t start = 0;
+  for (size_t i = 1; i <= length; ++i) {
+    if (i < length && signatures[indices[i]] == signatures[indices[start]])
+      continue;
+    if (i - start > 1) {
+      segment_t *segment = &search->segments[search->segments_count++];
+      segment->values = indices + start;
+      segment->length = i - start;
+    }
+    start = i;
+  }
+}
+
+/* Sort the lines and the blocks of one kind by their signatures */
+static void search_sort (search_t *search, size_t *blocks, size_t *lines,
+                         const bool column)
+{
+  size_t n = search->size;
+  size_t b = search->block;
+  uint64_t signatures[MAX_GRID_SIZE];
+  uint64_t block_signatures[MAX_GRID_SIZE];
+  for (size_t line = 0; line < n; ++line)
+    signatures[line] = line_signature(search, line, column);
+
+  for (size_t i = 0; i < b; ++i) {
+    uint64_t sorted[MAX_GRID_SIZE];
+    for (size_t k = 0; k < b; ++k) {
+      lines[i * b + k] = k;
+      sorted[k] = signatures[i * b + k];
+    }
+    sort_indices(lines + i * b, b, signatures + i * b);
+    sort_values(sorted, b);
+    block_signatures[i] = 0;
+    for (size_t k = 0; k < b; ++k)
+      block_signatures[i] = hash_mix(block_signatures[i], sorted[k]);
+    blocks[i] = i;
+  }
+  sort_indices(blocks, b, block_signatures);
+
+  search_segments(search, blocks, b, block_signatures);
+  for (size_t i = 0; i < b; ++i)
+    search_segments(search, lines + i * b, b, signatures + i * b);
+}
+
+static size_t order_line (const size_t *blocks, const size_t *lines,
+                          const size_t block, const size_t i)
+{
+  size_t b = blocks[i / block];
+  return b * block + lines[b * block + i % block];
+}
+
+/* Compare the current ordering to the best one found so far */
+static void search_evaluate (search_t *search, canon_t *canon)
+{
+  size_t n = search->size;
+  size_t b = search->block;
+  size_t rows[MAX_GRID_SIZE];
+  size_t columns[MAX_GRID_SIZE];
+  for (size_t i = 0; i < n; ++i) {
+    rows[i] = order_line(search->row_blocks, search->row_lines, b, i);
+    columns[i] = order_line(search->column_blocks, search->column_lines, b, i);
+  }
+
+  size_t colors[MAX_COLORS];
+  for (size_t i = 0; i < n; ++i)
+    colors[i] = MAX_COLORS;
+  size_t labels = 0;
+  bool better = !search->found;
+  for (size_t i = 0; i < n * n; ++i) {
+    int color = search_cell(search, rows[i / n], columns[i % n]);
+    unsigned char value = 0;
+    if (color >= 0) {
+      if (colors[color] == MAX_COLORS)
+        colors[color] = labels++;
+      value = colors[color] + 1;
+    }
+    if (!better) {
+      if (value > canon->key[i])
+        return;
+      if (value < canon->key[i])
+        better = true;
+    }
+    search->candidate[i] = value;
+  }
+  if (!better)
+    return;
+
+  search->found = true;
+  memcpy(canon->key, search->candidate, n * n);
+  canon->transpose = search->transpose;
+  memcpy(canon->rows, rows, n * sizeof(size_t));
+  memcpy(canon->columns, columns, n * sizeof(size_t));
+  memcpy(canon->colors, colors, n * sizeof(size_t));
+}
+
+/* Try every ordering of the lines that share the same invariants */
+static void search_orientation (search_t *search, canon_t *canon)
+{
+  search->segments_count = 0;
+  search_sort(search, search->row_blocks, search->row_lines, false);
+  search_sort(search, search->column_blocks, search->column_lines, true);
+
+  size_t total = 1;
+  for (size_t i = 0; i < search->segments_count && total <= CANON_BUDGET; ++i)
+    for (size_t k = 2; k <= search->segments[i].length; ++k) {
+      total *= k;
+      if (total > CANON_BUDGET)
+        break;
+    }
+  if (total > CANON_BUDGET)
+    search->segments_count = 0;
+
+  while (true) {
+    search_evaluate(search, canon);
+    size_t i = 0;
+    while (i < search->segments_count &&
+           !permutation_next(search->segments[i].values,
+                             search->segments[i].length))
+      ++i;
+    if (i == search->segments_count)
+      break;
+  }
+}
+
+canon_t *canon_new (const grid_t *grid)
+{
+  size_t n = grid_get_size(grid);
+  if (n == 0)
+    return NULL;
+
+  canon_t *canon = malloc(sizeof(canon_t) + n * n);
+  int *cells = malloc(n * n * sizeof(int));
+  unsigned char *candidate = malloc(n * n);
+  search_t *search = malloc(sizeof(search_t));
+  if (!canon || !cells || !candidate || !search) {
+    free(canon);
+    free(cells);
+    free(candidate);
+    free(search);
+    return NULL;
+  }
+
+  size_t frequency[MAX_COLORS] = { 0 };
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < n; ++j) {
+      colors_t colors = grid_get_colors(grid, i, j);
+      cells[i * n + j] = -1;
+      if (colors_is_singleton(colors)) {
+        cells[i * n + j] = colors_index(colors);
+        ++frequency[colors_index(colors)];
+      }
+    }
+
+  search->size = n;
+  search->block = 1;
+  while (search->block * search->block < n)
+    ++search->block;
+  search->cells = cells;
+  search->frequency = frequency;
+  search->candidate = candidate;
+  search->found = false;
+  canon->size = n;
+  for (size_t t = 0; t < 2; ++t) {
+    search->transpose = t;
+    search_orientation(search, canon);
+  }
+
+  /* Colors absent from the givens take the remaining labels in order */
+  size_t labels = 0;
+  for (size_t i = 0; i < n; ++i)
+    if (canon->colors[i] != MAX_COLORS)
+      ++labels;
+  for (size_t i = 0; i < n; ++i)
+    if (canon->colors[i] == MAX_COLORS)
+      canon->colors[i] = labels++;
+
+  canon->hash = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < n * n; ++i) {
+    canon->hash ^= canon->key[i];
+    canon->hash *= 0x100000001B3ULL;
+  }
+
+  free(cells);
+  free(candidate);
+  free(search);
+  return canon;
+}
+
+void canon_free (canon_t *canon)
+{
+  free(canon);
+}
+
+size_t canon_get_size (const canon_t *canon)
+{
+  return canon->size;
+}
+
+const unsigned char *canon_get_key (const canon_t *canon)
+{
+  return canon->key;
+}
+
+uint64_t canon_hash (const canon_t *canon)
+{
+  return canon->hash;
+}
+
+/* Cell of the original grid at a canonical position */
+static void canon_position (const canon_t *canon, const size_t i,
+                            const size_t j, size_t *row, size_t *column)
+{
+  *row = canon->rows[i];
+  *column = canon->columns[j];
+  if (canon->transpose) {
+    size_t temp = *row;
+    *row = *column;
+    *column = temp;
+  }
+}
+
+void canon_encode (const canon_t *canon, const grid_t *grid,
+                   unsigned char *cells)
+{
+  size_t n = canon->size;
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < n; ++j) {
+      size_t row, column;
+      canon_position(canon, i, j, &row, &column);
+      colors_t colors = grid_get_colors(grid, row, column);
+      cells[i * n + j] = 0;
+      if (colors_is_singleton(colors))
+        cells[i * n + j] = canon->colors[colors_index(colors)] + 1;
+    }
+}
+
+grid_t *canon_decode (const canon_t *canon, const unsigned char *cells)
+{
+  size_t n = canon->size;
+  grid_t *grid = grid_alloc(n);
+  if (!grid)
+    return NULL;
+
+  size_t inverse[MAX_COLORS];
+  for (size_t i = 0; i < n; ++i)
+    inverse[canon->colors[i]] = i;
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < n; ++j) {
+      if (cells[i * n + j] == 0 || cells[i * n + j] > n)
+        continue;
+      size_t row, column;
+      canon_position(canon, i, j, &row, &column);
+      grid_set_colors(grid, row, column,
+                      colors_set(inverse[cells[i * n + j] - 1]));
+    }
+  return grid;
+}
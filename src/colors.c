@@ -1,7 +1,69 @@
 #include "colors.h"
 
+#include "trace.h"
+
 #include <stdlib.h>
 
+/* Number of bits set in a word */
+static size_t bits_count (const uint64_t bits)
+{ 
+  uint64_t x = bits;
+  uint64_t b5 = ~((-1ULL) << 32);
+  uint64_t b4 = b5 ^ (b5 << 16);
+  uint64_t b3 = b4 ^ (b4 << 8);
+  uint64_t b2 = b3 ^ (b3 << 4);
+  uint64_t b1 = b2 ^ (b2 << 2);
+  uint64_t b0 = b1 ^ (b1 << 1);
+
+  x = ((x >> 1) & b0) + (x & b0);
+  x = ((x >> 2) & b1) + (x & b1);
+  x = ((x >> 4) + x) & b2;
+  x = ((x >> 8) + x) & b3;
+  x = ((x >> 16) + x) & b4;
+  x = ((x >> 32) + x) & b5;
+  return (size_t) x;
+}
+
+/* Position of the leftmost bit set in a word that is not 0 */
+static size_t bits_leftmost (const uint64_t bits)
+{
+  uint64_t x = bits >> 1;
+  size_t count = 0; 
+  while (x != 0) {
+    x >>= 1;
+    ++count;
+  }
+  return count;
+}
+
+/* Transpose in place the bit matrix of the first width words, bit j of
+   word i going to bit i of word j. width is a power of two from 2 to 64: the
+   matrix is split in four blocks, the two off-diagonal ones are swapped,
+   and so on recursively on all the blocks at once. */
+static void bits_transpose (uint64_t matrix[], const size_t width)
+{
+  uint64_t mask = UINT64_MAX;
+  for (size_t j = 32; j >= width / 2; j >>= 1)
+    mask ^= mask << j;
+  for (size_t j = width / 2; j != 0; j >>= 1, mask ^= mask << j)
+    for (size_t k = 0; k < width; k = (k + j + 1) & ~j) {
+      uint64_t t = ((matrix[k] >> j) ^ matrix[k + j]) & mask;
+      matrix[k] ^= t << j;
+      matrix[k + j] ^= t;
+    }
+}
+
+/* Smallest power of two at least size, and at least 2 */
+static size_t bits_width (const size_t size)
+{
+  size_t width = 2;
+  while (width < size)
+    width <<= 1;
+  return width;
+}
+
+#if COLORS_WORDS == 1
+
 colors_t colors_full (const size_t size)
 {
   if (size >= MAX_COLORS)
@@ -21,16 +83,6 @@ colors_t colors_set (const size_t color_id)
   return 1ULL << color_id;
 }
 
-colors_t colors_add (const colors_t colors, const size_t color_id)
-{
-  return colors | colors_set(color_id);
-}
-
-colors_t colors_discard (const colors_t colors, const size_t color_id)
-{
-  return colors & ~colors_set(color_id);
-}
-
 bool colors_is_in (const colors_t colors, const size_t color_id)
 { 
   if (color_id >= MAX_COLORS)
@@ -73,6 +125,11 @@ bool colors_is_subset (const colors_t colors1, const colors_t colors2)
   return colors1 == (colors1 & colors2);
 }
 
+bool colors_is_empty (const colors_t colors)
+{
+  return colors == 0;
+}
+
 bool colors_is_singleton (const colors_t colors)
 {
   if (colors == colors_empty())
@@ -83,21 +140,14 @@ bool colors_is_singleton (const colors_t colors)
 
 size_t colors_count (const colors_t colors)
 { 
-  colors_t x = colors;
-  colors_t b5 = ~((-1ULL) << 32);
-  colors_t b4 = b5 ^ (b5 << 16);
-  colors_t b3 = b4 ^ (b4 << 8);
-  colors_t b2 = b3 ^ (b3 << 4);
-  colors_t b1 = b2 ^ (b2 << 2);
-  colors_t b0 = b1 ^ (b1 << 1);
+  return bits_count(colors);
+}
 
-  x = ((x >> 1) & b0) + (x & b0);
-  x = ((x >> 2) & b1) + (x & b1);
-  x = ((x >> 4) + x) & b2;
-  x = ((x >> 8) + x) & b3;
-  x = ((x >> 16) + x) & b4;
-  x = ((x >> 32) + x) & b5;
-  return (size_t) x;
+size_t colors_index (const colors_t colors)
+{
+  if (colors == colors_empty())
+    return MAX_COLORS;
+  return colors_count(colors_rightmost(colors) - 1);
 }
 
 colors_t colors_rightmost (const colors_t colors)
@@ -110,59 +160,254 @@ colors_t colors_leftmost (const colors_t colors)
   if (colors == colors_empty())
     return colors_empty();
 
-  colors_t x = colors >> 1;
-  size_t count = 0; 
-  while (x != 0) {
-    x >>= 1;
-    ++count;
+  return colors_set(bits_leftmost(colors));
+}
+
+void colors_transpose (colors_t *const rows[], colors_t columns[],
+                       const size_t size)
+{
+  size_t width = bits_width(size);
+  uint64_t matrix[64];
+  for (size_t i = 0; i < width; ++i)
+    matrix[i] = (i < size) ? *rows[i] : 0;
+  bits_transpose(matrix, width);
+  for (size_t i = 0; i < size; ++i)
+    columns[i] = matrix[i];
+}
+
+#else /* COLORS_WORDS > 1 */
+
+colors_t colors_full (const size_t size)
+{
+  colors_t colors;
+  for (size_t w = 0; w < COLORS_WORDS; ++w) {
+    if (size >= 64 * (w + 1))
+      colors.words[w] = UINT64_MAX;
+    else if (size > 64 * w)
+      colors.words[w] = (1ULL << (size - 64 * w)) - 1;
+    else
+      colors.words[w] = 0;
   }
-  
-  return colors_set(count);
+  return colors;
+}
+
+colors_t colors_empty ()
+{
+  colors_t colors;
+  for (size_t w = 0; w < COLORS_WORDS; ++w)
+    colors.words[w] = 0;
+  return colors;
+}
+
+colors_t colors_set (const size_t color_id)
+{
+  colors_t colors = colors_empty();
+  if (color_id < MAX_COLORS)
+    colors.words[color_id / 64] = 1ULL << (color_id % 64);
+  return colors;
+}
+
+bool colors_is_in (const colors_t colors, const size_t color_id)
+{ 
+  if (color_id >= MAX_COLORS)
+    return false;
+  return (colors.words[color_id / 64] >> (color_id % 64)) % 2 == 1;
+}
+
+colors_t colors_negate (const colors_t colors)
+{ 
+  colors_t result;
+  for (size_t w = 0; w < COLORS_WORDS; ++w)
+    result.words[w] = ~colors.words[w];
+  return result;
+} 
+
+colors_t colors_and (const colors_t colors1, const colors_t colors2)
+{
+  colors_t result;
+  for (size_t w = 0; w < COLORS_WORDS; ++w)
+    result.words[w] = colors1.words[w] & colors2.words[w];
+  return result;
+}
+
+colors_t colors_or (const colors_t colors1, const colors_t colors2)
+{
+  colors_t result;
+  for (size_t w = 0; w < COLORS_WORDS; ++w)
+    result.words[w] = colors1.words[w] | colors2.words[w];
+  return result;
+}
+
+colors_t colors_xor (const colors_t colors1, const colors_t colors2)
+{
+  colors_t result;
+  for (size_t w = 0; w < COLORS_WORDS; ++w)
+    result.words[w] = colors1.words[w] ^ colors2.words[w];
+  return result;
+}
+
+colors_t colors_subtract (const colors_t colors1, const colors_t colors2)
+{
+  colors_t result;
+  for (size_t w = 0; w < COLORS_WORDS; ++w)
+    result.words[w] = colors1.words[w] & ~colors2.words[w];
+  return result;
+}
+
+bool colors_is_equal (const colors_t colors1, const colors_t colors2)
+{
+  for (size_t w = 0; w < COLORS_WORDS; ++w)
+    if (colors1.words[w] != colors2.words[w])
+      return false;
+  return true;
+}
+
+bool colors_is_subset (const colors_t colors1, const colors_t colors2)
+{ 
+  for (size_t w = 0; w < COLORS_WORDS; ++w)
+    if (colors1.words[w] & ~colors2.words[w])
+      return false;
+  return true;
+}
+
+bool colors_is_empty (const colors_t colors)
+{
+  for (size_t w = 0; w < COLORS_WORDS; ++w)
+    if (colors.words[w])
+      return false;
+  return true;
+}
+
+bool colors_is_singleton (const colors_t colors)
+{
+  bool found = false;
+  for (size_t w = 0; w < COLORS_WORDS; ++w) {
+    uint64_t x = colors.words[w];
+    if (!x)
+      continue;
+    if (found || (x & (x - 1)))
+      return false;
+    found = true;
+  }
+  return found;
+}
+
+size_t colors_count (const colors_t colors)
+{ 
+  size_t count = 0;
+  for (size_t w = 0; w < COLORS_WORDS; ++w)
+    count += bits_count(colors.words[w]);
+  return count;
+}
+
+size_t colors_index (const colors_t colors)
+{
+  for (size_t w = 0; w < COLORS_WORDS; ++w) {
+    uint64_t x = colors.words[w];
+    if (x)
+      return 64 * w + bits_count((x & (~x + 1)) - 1);
+  }
+  return MAX_COLORS;
+}
+
+colors_t colors_rightmost (const colors_t colors)
+{
+  return colors_set(colors_index(colors));
+}
+
+colors_t colors_leftmost (const colors_t colors)
+{
+  for (size_t w = COLORS_WORDS; w > 0; --w)
+    if (colors.words[w - 1])
+      return colors_set(64 * (w - 1) + bits_leftmost(colors.words[w - 1]));
+  return colors_empty();
+}
+
+void colors_transpose (colors_t *const rows[], colors_t columns[],
+                       const size_t size)
+{
+  /* Blocks of 64x64 bits, each transposed into the mirrored block */
+  size_t blocks = (size + 63) / 64;
+  size_t width = (blocks == 1) ? bits_width(size) : 64;
+  uint64_t matrix[64];
+  for (size_t i = 0; i < size; ++i)
+    columns[i] = colors_empty();
+  for (size_t r = 0; r < blocks; ++r)
+    for (size_t c = 0; c < blocks; ++c) {
+      for (size_t i = 0; i < width; ++i)
+        matrix[i] = (64 * r + i < size) ? rows[64 * r + i]->words[c] : 0;
+      bits_transpose(matrix, width);
+      for (size_t i = 0; i < width && 64 * c + i < size; ++i)
+        columns[64 * c + i].words[r] = matrix[i];
+    }
+}
+
+#endif /* COLORS_WORDS */
+
+colors_t colors_add (const colors_t colors, const size_t color_id)
+{
+  return colors_or(colors, colors_set(color_id));
+}
+
+colors_t colors_discard (const colors_t colors, const size_t color_id)
+{
+  return colors_subtract(colors, colors_set(color_id));
 }
 
 colors_t colors_random(const colors_t colors)
 {
-  if (!colors)
-    return 0;
-  
-  size_t count = colors_count(colors);
-  colors_t *set = malloc(count * sizeof(colors_t));
-  if (!set)
-    return 0;
+  if (colors_is_empty(colors))
+    return colors_empty();
   
   /* PRNG need to be initialized with srand() before calling this function */
+  size_t index = rand() % colors_count(colors);
   colors_t x = colors;
-  size_t i = 0;
-  size_t j = 0;
-  while (x != 0) {
-    if (x & 1)
-      set[i++] = colors_set(j);
-    x >>= 1;
-    ++j;
-  }
-  x = set[rand() % count];
-  free(set);
-  return x;
+  for (size_t i = 0; i < index; ++i)
+    x = colors_subtract(x, colors_rightmost(x));
+  return colors_rightmost(x);
+}
+
+colors_t colors_random_r (const colors_t colors, uint64_t *seed)
+{
+  if (colors_is_empty(colors))
+    return colors_empty();
+
+  size_t index = random_next(seed) % colors_count(colors);
+  colors_t x = colors;
+  for (size_t i = 0; i < index; ++i)
+    x = colors_subtract(x, colors_rightmost(x));
+  return colors_rightmost(x);
+}
+
+uint64_t random_next (uint64_t *seed)
+{
+  /* xorshift64*, the state must never be zero */
+  uint64_t x = *seed ? *seed : 0x9E3779B97F4A7C15ULL;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *seed = x;
+  return x * 0x2545F4914F6CDD1DULL;
 }
 
 bool subgrid_consistency (const colors_t subgrid[], const size_t size)
 { 
-  colors_t singleton = 0;
-  colors_t appeared = 0;
+  colors_t singleton = colors_empty();
+  colors_t appeared = colors_empty();
   for (size_t i = 0; i < size; ++i) {
-    if (!subgrid[i]) {
+    if (colors_is_empty(subgrid[i])) {
       return false;
     }
     if (colors_is_singleton(subgrid[i])) {
-      if ((subgrid[i] & singleton) == subgrid[i]) {
+      if (colors_is_subset(subgrid[i], singleton)) {
         return false;
       }
-      singleton |= subgrid[i];
+      singleton = colors_or(singleton, subgrid[i]);
     }
-    appeared |= subgrid[i];
+    appeared = colors_or(appeared, subgrid[i]);
   }
 
-  return appeared == colors_full(size);
+  return colors_is_equal(appeared, colors_full(size));
 }
 
 bool subgrid_heuristics(colors_t *subgrid[], size_t size, size_t level)
@@ -174,17 +419,18 @@ bool subgrid_heuristics(colors_t *subgrid[], size_t size, size_t level)
 
 bool cross_hatching (colors_t *subgrid[], size_t size)
 {
+  TRACE_SPAN("cross_hatching");
   bool changed = false;
-  colors_t colors = 0;
+  colors_t colors = colors_empty();
   for (size_t i = 0; i < size; ++i)
     if (colors_is_singleton(*subgrid[i]))
-      colors |= *subgrid[i];
+      colors = colors_or(colors, *subgrid[i]);
   for (size_t i = 0; i < size; ++i) {
     if (colors_is_singleton(*subgrid[i]))
       continue;
 
     colors_t new = colors_subtract(*subgrid[i], colors);
-    if (*subgrid[i] != new) {
+    if (!colors_is_equal(*subgrid[i], new)) {
       changed = true;
       *subgrid[i] = new;
     }
@@ -194,21 +440,22 @@ bool cross_hatching (colors_t *subgrid[], size_t size)
 
 bool lone_number (colors_t *subgrid[], size_t size)
 {
+  TRACE_SPAN("lone_number");
   bool changed = false;
   colors_t appeared = *subgrid[0];
-  colors_t repeated = 0;
+  colors_t repeated = colors_empty();
   for (size_t i = 1; i < size; ++i) {
-    repeated |= appeared & *subgrid[i];
-    appeared |= *subgrid[i];
+    repeated = colors_or(repeated, colors_and(appeared, *subgrid[i]));
+    appeared = colors_or(appeared, *subgrid[i]);
   }
   colors_t lone = colors_subtract(appeared, repeated);
-  if (lone == 0)
+  if (colors_is_empty(lone))
     return changed;
 
   for (size_t i = 0; i < size; ++i) {
     if (colors_is_singleton(*subgrid[i]))
       continue;
-    colors_t new = *subgrid[i] & lone;
+    colors_t new = colors_and(*subgrid[i], lone);
     if (colors_is_singleton(new)) {
       changed = true;
       *subgrid[i] = new;
@@ -219,6 +466,7 @@ bool lone_number (colors_t *subgrid[], size_t size)
 
 bool naked_subset (colors_t *subgrid[], size_t size)
 { 
+  TRACE_SPAN("naked_subset");
   bool changed = false;
   for (size_t i = 0; i < size; ++i) {
     if (colors_is_singleton(*subgrid[i]))
@@ -240,7 +488,7 @@ bool naked_subset (colors_t *subgrid[], size_t size)
         continue;
 
       colors_t new = colors_subtract(*subgrid[j], *subgrid[i]);
-      if (*subgrid[j] != new) {
+      if (!colors_is_equal(*subgrid[j], new)) {
         *subgrid[j] = new;
         changed = true;
       }
@@ -251,25 +499,16 @@ bool naked_subset (colors_t *subgrid[], size_t size)
 
 bool hidden_subset (colors_t *subgrid[], size_t size)
 {
+  TRACE_SPAN("hidden_subset");
   bool changed = false;
-  colors_t *position = malloc(size * sizeof(colors_t));
-  if (!position)
-    return changed;
-  
-  for (size_t i = 0; i < size; ++i) {
-    position[i] = 0;
-  }
-  for (size_t i = 0; i < size; ++i) {
-    for (size_t j = 0; j < size; ++j)
-      if (colors_is_in(*subgrid[i], j))
-        position[j] += colors_set(i);
-  }
+  colors_t position[size];
+  colors_transpose(subgrid, position, size);
 
   for (size_t i = 0; i < size; ++i) {
     if (colors_is_singleton(position[i]))
       continue;
 
-    colors_t set = 0;
+    colors_t set = colors_empty();
     size_t count = 0;
     for (size_t j = 0; j < size; ++j) {
       if (colors_is_singleton(position[j]) || 
@@ -277,19 +516,18 @@ bool hidden_subset (colors_t *subgrid[], size_t size)
         continue;
 
       ++count;
-      set += colors_set(j);
+      set = colors_add(set, j);
     }
     if (count != colors_count(position[i]))
       continue;
 
     for (size_t j = 0; j < size; ++j) {
-      colors_t new = *subgrid[j] & set;
-      if (new && new != *subgrid[j]) {
+      colors_t new = colors_and(*subgrid[j], set);
+      if (!colors_is_empty(new) && !colors_is_equal(new, *subgrid[j])) {
         *subgrid[j] = new;
         changed = true;
       }
     }
   }
-  free(position);
   return changed;
 }
@@ -1,13 +1,41 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "grid.h"
 
 #include "colors.h"
+#include "trace.h"
 
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+/* Number of grids allocated at once by a pool */
+#define GRID_POOL_SLAB 64
+
+typedef struct slab_t slab_t;
+
+struct slab_t
+{
+  slab_t *next;
+  char blocks[];
+};
+
+struct grid_pool_t
+{
+  size_t size;
+  slab_t *slabs;
+  slab_t *current;
+  size_t used;
+  grid_t *recycled;
+};
 
 struct _grid_t
 {
   size_t size;
   colors_t **cells;
+  grid_pool_t *pool;
+  grid_t *next;
 };
 
 struct choice_t
@@ -22,53 +50,173 @@ bool grid_check_char (const grid_t *grid, const char c)
   if (c == EMPTY_CELL)
     return true;
 
-  for (size_t i = 0; i < grid->size; ++i)
+  for (size_t i = 0; i < grid->size && i < COLOR_TABLE_SIZE; ++i)
     if (c == color_table[i])
       return true;
   return false;
 }
 
+/* Lay out a grid in a block of grid_sizeof(size) bytes: the header, then
+   the row pointers, then all the cells contiguously */
+static grid_t *grid_format (void *block, size_t size, grid_pool_t *pool)
+{
+  grid_t *grid = block;
+  colors_t **rows = (colors_t **) (grid + 1);
+  colors_t *cells = (colors_t *) (rows + size);
+  for (size_t i = 0; i < size; ++i)
+    rows[i] = cells + i * size;
+
+  grid->size = size;
+  grid->cells = rows;
+  grid->pool = pool;
+  grid->next = NULL;
+  return grid;
+}
+
+/* Get a grid with uninitialized cells, from the pool or from the heap */
+static grid_t *grid_take (grid_pool_t *pool, size_t size)
+{
+  if (!pool) {
+    void *block = malloc(grid_sizeof(size));
+    if (!block)
+      return NULL;
+    return grid_format(block, size, NULL);
+  }
+
+  if (pool->recycled) {
+    grid_t *grid = pool->recycled;
+    pool->recycled = grid->next;
+    grid->next = NULL;
+    return grid;
+  }
+
+  size_t block_size = grid_sizeof(pool->size);
+  if (!pool->current || pool->used == GRID_POOL_SLAB) {
+    slab_t *slab = pool->current ? pool->current->next : pool->slabs;
+    if (!slab) {
+      slab = malloc(sizeof(slab_t) + GRID_POOL_SLAB * block_size);
+      if (!slab)
+        return NULL;
+      slab->next = NULL;
+      if (pool->current)
+        pool->current->next = slab;
+      else
+        pool->slabs = slab;
+    }
+    pool->current = slab;
+    pool->used = 0;
+  }
+  void *block = pool->current->blocks + pool->used * block_size;
+  ++pool->used;
+  return grid_format(block, pool->size, pool);
+}
+
 grid_t *grid_alloc (size_t size)
 { 
   if (!grid_check_size(size))
     return NULL;
 
-  colors_t **cells = malloc(size * sizeof(colors_t*));
-  if (cells== NULL)
+  grid_t *grid = grid_take(NULL, size);
+  if (!grid)
     return NULL;
-  
-  for (size_t i = 0; i < size; ++i) {
-    cells[i] = malloc(size * sizeof(colors_t));
-    if (!cells[i])
-    {
-      for (size_t j = 0; j < size; ++j)
-        free(cells[j]);
-      free(cells);
-      return NULL;
-    }
 
+  for (size_t i = 0; i < size; ++i)
     for (size_t j = 0; j < size; ++j)
-      cells[i][j] = colors_full(size);
+      grid->cells[i][j] = colors_full(size);
+  return grid;
+}
+
+void grid_free (grid_t *grid)
+{ 
+  if (grid == NULL)
+    return;
+
+  if (grid->pool) {
+    grid->next = grid->pool->recycled;
+    grid->pool->recycled = grid;
+    return;
+  }
+  free(grid);
+}
+
+grid_pool_t *grid_pool_new (size_t size)
+{
+  if (!grid_check_size(size))
+    return NULL;
+
+  grid_pool_t *pool = malloc(sizeof(grid_pool_t));
+  if (!pool)
+    return NULL;
+
+  pool->size = size;
+  pool->slabs = NULL;
+  pool->current = NULL;
+  pool->used = 0;
+  pool->recycled = NULL;
+  return pool;
+}
+
+void grid_pool_free (grid_pool_t *pool)
+{
+  if (!pool)
+    return;
+
+  slab_t *slab = pool->slabs;
+  while (slab) {
+    slab_t *next = slab->next;
+    free(slab);
+    slab = next;
   }
+  free(pool);
+}
 
-  grid_t *grid = malloc(sizeof(grid_t));
+void grid_pool_reset (grid_pool_t *pool)
+{
+  if (!pool)
+    return;
+
+  pool->recycled = NULL;
+  pool->current = NULL;
+  pool->used = 0;
+}
+
+size_t grid_pool_get_size (const grid_pool_t *pool)
+{
+  if (!pool)
+    return 0;
+  return pool->size;
+}
+
+grid_t *grid_pool_alloc (grid_pool_t *pool)
+{
+  if (!pool)
+    return NULL;
+
+  grid_t *grid = grid_take(pool, pool->size);
   if (!grid)
     return NULL;
 
-  grid->size = size;
-  grid->cells = cells;
+  for (size_t i = 0; i < pool->size; ++i)
+    for (size_t j = 0; j < pool->size; ++j)
+      grid->cells[i][j] = colors_full(pool->size);
   return grid;
 }
 
-void grid_free (grid_t *grid)
-{ 
+grid_t *grid_pool_copy (grid_pool_t *pool, const grid_t *grid)
+{
+  TRACE_SPAN("grid_copy");
   if (grid == NULL)
-    return;
+    return NULL;
+  if (pool && pool->size != grid->size)
+    return NULL;
 
-  for (size_t i = 0; i < grid->size; ++i)
-      free(grid->cells[i]);
-  free(grid->cells);
-  free(grid);
+  grid_t *grid_new = grid_take(pool, grid->size);
+  if (grid_new == NULL)
+    return NULL;
+
+  memcpy(grid_new->cells[0], grid->cells[0],
+         grid->size * grid->size * sizeof(colors_t));
+  return grid_new;
 }
 
 void grid_print (const grid_t *grid, FILE *fd)
@@ -90,10 +238,18 @@ void grid_print (const grid_t *grid, FILE *fd)
   fputs("\n", fd);
 }
 
+size_t grid_sizeof (const size_t size)
+{
+  return sizeof(grid_t) + size * sizeof(colors_t*) + 
+         size * size * sizeof(colors_t);
+}
+
 bool grid_check_size (const size_t size)
 {
-  return size == 1 || size == 4 || size == 9 || size == 16 || 
-         size == 25 || size == 36 || size == 49 || size == 64;
+  size_t block = 1;
+  while (block * block < size)
+    ++block;
+  return size > 0 && size <= MAX_GRID_SIZE && block * block == size;
 }
 
 grid_t *grid_copy (const grid_t *grid)
@@ -101,14 +257,7 @@ grid_t *grid_copy (const grid_t *grid)
   if (grid == NULL)
     return NULL;
 
-  grid_t *grid_new = grid_alloc(grid->size);
-  if (grid_new == NULL)
-    return NULL;
-
-  for (size_t i = 0; i < grid->size; ++i) 
-    for (size_t j = 0; j < grid->size; ++j)
-      grid_new->cells[i][j] = grid->cells[i][j];
-  return grid_new;
+  return grid_pool_copy(grid->pool, grid);
 }
 
 char *grid_get_cell (const grid_t *grid, const size_t row, const size_t column)
@@ -118,19 +267,24 @@ char *grid_get_cell (const grid_t *grid, const size_t row, const size_t column)
   if (row >= grid->size || column >= grid->size)
     return NULL;
   colors_t cell = grid->cells[row][column];
-  char *content = calloc(grid->size + 1, sizeof(char));
+  bool numeric = grid->size > COLOR_TABLE_SIZE;
+  /* Numeric colors take up to 3 digits and a comma each */
+  char *content = calloc(numeric ? 4 * grid->size + 1 : grid->size + 1,
+                         sizeof(char));
   if (content == NULL)
     return NULL;
   
   content[0] = EMPTY_CELL;
-  if (cell == colors_full(grid->size) && grid->size != 1) {
+  if (colors_is_equal(cell, colors_full(grid->size)) && grid->size != 1) {
     return content;
   }
   size_t j = 0;
   for (size_t i = 0; i < grid->size; ++i)
     if (colors_is_in(cell, i)) {
-      content[j] = color_table[i];
-      ++j;
+      if (numeric)
+        j += sprintf(content + j, (j > 0) ? ",%zu" : "%zu", i + 1);
+      else
+        content[j++] = color_table[i];
     }
   return content;
 }
@@ -154,13 +308,29 @@ void grid_set_cell (grid_t *grid, const size_t row,
     grid->cells[row][column] = colors_full(grid->size);
     return;
   }
-  for (size_t i = 0; i < grid->size; ++i)
+  for (size_t i = 0; i < grid->size && i < COLOR_TABLE_SIZE; ++i)
     if (color == color_table[i]) {
       grid->cells[row][column] = colors_set(i);
       return;
     }
 }
 
+colors_t grid_get_colors (const grid_t *grid, const size_t row,
+                          const size_t column)
+{
+  if (!grid || row >= grid->size || column >= grid->size)
+    return colors_empty();
+  return grid->cells[row][column];
+}
+
+void grid_set_colors (grid_t *grid, const size_t row, const size_t column,
+                      const colors_t colors)
+{
+  if (!grid || row >= grid->size || column >= grid->size)
+    return;
+  grid->cells[row][column] = colors;
+}
+
 bool grid_is_solved (grid_t *grid)
 {
   if (!grid)
@@ -177,24 +347,18 @@ bool grid_is_consistent (grid_t *grid)
 {
   if (grid->size == 1)
     return true;
-  colors_t *subgrid = malloc(grid->size * sizeof(colors_t));
-  if (!subgrid)
-    return NULL;
+  colors_t subgrid[grid->size];
 
   for (size_t index = 0; index < grid->size; ++index) {
     for (size_t i = 0; i < grid->size; ++i)
       subgrid[i] = grid->cells[index][i];
-    if (!subgrid_consistency(subgrid, grid->size)) {
-      free(subgrid);
+    if (!subgrid_consistency(subgrid, grid->size))
       return false;
-    }
   
     for (size_t i = 0; i < grid->size; ++i)
       subgrid[i] = grid->cells[i][index];
-    if (!subgrid_consistency(subgrid, grid->size)) {
-      free(subgrid);
+    if (!subgrid_consistency(subgrid, grid->size))
       return false;
-    }
   
     size_t block_size = sqrt(grid->size);
     size_t start_row = index / block_size * block_size;
@@ -205,46 +369,233 @@ bool grid_is_consistent (grid_t *grid)
         subgrid[c++] = grid->cells[i][j];
       }
     }
-    if (!subgrid_consistency(subgrid, grid->size)) {
-      free(subgrid);
+    if (!subgrid_consistency(subgrid, grid->size))
+      return false;
+  }
+  return true;
+}
+
+bool grid_verify (const uint8_t cells[], const size_t size,
+                  const uint8_t clues[])
+{
+  if (!grid_check_size(size))
+    return false;
+
+  /* Every unit holds size cells, so it holds every color once when the
+     union of their bits, in words of 64, is full */
+  size_t block = 1;
+  while (block * block < size)
+    ++block;
+  size_t words = (size + 63) / 64;
+  uint64_t units[3 * size * words];
+  memset(units, 0, sizeof(units));
+  uint64_t *rows = units;
+  uint64_t *columns = units + size * words;
+  uint64_t *boxes = units + 2 * size * words;
+  bool valid = true;
+  size_t cell = 0;
+  for (size_t i = 0; i < size; ++i) {
+    uint64_t *row = rows + i * words;
+    uint64_t *box = boxes + i / block * block * words;
+    for (size_t j = 0, k = 0; j < size; ++j, ++cell) {
+      size_t color = cells[cell] - 1;
+      valid &= color < size;
+      if (clues)
+        valid &= clues[cell] == 0 || clues[cell] == color + 1;
+      size_t word = (color >> 6) & (words - 1);
+      uint64_t bit = (uint64_t) 1 << (color & 63);
+      row[word] |= bit;
+      columns[j * words + word] |= bit;
+      box[word] |= bit;
+      if (++k == block) {
+        k = 0;
+        box += words;
+      }
+    }
+  }
+
+  for (size_t w = 0; w < words; ++w) {
+    size_t left = size - 64 * w;
+    uint64_t full = left >= 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << left) - 1;
+    for (size_t u = 0; u < 3 * size; ++u)
+      valid &= units[u * words + w] == full;
+  }
+  return valid;
+}
+
+/* Kinds of units, propagated in a parallel phase each */
+typedef enum { UNIT_ROW, UNIT_COLUMN, UNIT_BOX } unit_kind_t;
+
+static bool unit_heuristics (grid_t *grid, const unit_kind_t kind,
+                             const size_t index, const size_t level)
+{
+  colors_t *subgrid[grid->size];
+  if (kind == UNIT_ROW)
+    for (size_t i = 0; i < grid->size; ++i)
+      subgrid[i] = &grid->cells[index][i];
+  else if (kind == UNIT_COLUMN)
+    for (size_t i = 0; i < grid->size; ++i)
+      subgrid[i] = &grid->cells[i][index];
+  else {
+    size_t block_size = sqrt(grid->size);
+    size_t start_row = index / block_size * block_size;
+    size_t start_column = index % block_size * block_size;
+    size_t c = 0;
+    for (size_t i = start_row; i < start_row + block_size; ++i)
+      for (size_t j = start_column; j < start_column + block_size; ++j)
+        subgrid[c++] = &grid->cells[i][j];
+  }
+  return subgrid_heuristics(subgrid, grid->size, level);
+}
+
+/* Persistent threads sharing the units of a phase with the propagating
+   thread. The units of a phase are disjoint, so they are changed in place
+   without locks, and a phase ends when every thread is done with it. The
+   pool serves one grid at a time, the others propagate alone. */
+typedef struct
+{
+  pthread_mutex_t busy;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  pthread_t *threads;
+  size_t count;
+  bool quit;
+  size_t phase;
+  size_t running;
+  grid_t *grid;
+  unit_kind_t kind;
+  size_t level;
+  atomic_size_t next;
+  atomic_bool fix;
+} propagator_t;
+
+static propagator_t propagator = {
+  .busy = PTHREAD_MUTEX_INITIALIZER,
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER
+};
+
+/* Take units of the current phase until there are none left */
+static void propagator_units (void)
+{
+  grid_t *grid = propagator.grid;
+  bool fix = false;
+  size_t index;
+  while ((index = atomic_fetch_add(&propagator.next, 1)) < grid->size)
+    fix |= unit_heuristics(grid, propagator.kind, index, propagator.level);
+  if (fix)
+    atomic_store(&propagator.fix, true);
+}
+
+static void *propagator_worker (void *data)
+{
+  (void) data;
+  size_t seen = 0;
+  pthread_mutex_lock(&propagator.lock);
+  while (true) {
+    while (propagator.phase == seen && !propagator.quit)
+      pthread_cond_wait(&propagator.wake, &propagator.lock);
+    if (propagator.quit)
+      break;
+    seen = propagator.phase;
+    pthread_mutex_unlock(&propagator.lock);
+
+    propagator_units();
+
+    pthread_mutex_lock(&propagator.lock);
+    if (--propagator.running == 0)
+      pthread_cond_signal(&propagator.done);
+  }
+  pthread_mutex_unlock(&propagator.lock);
+  return NULL;
+}
+
+/* Propagate every unit of a kind, true if a cell changed */
+static bool propagator_phase (grid_t *grid, const unit_kind_t kind,
+                              const size_t level)
+{
+  pthread_mutex_lock(&propagator.lock);
+  propagator.grid = grid;
+  propagator.kind = kind;
+  propagator.level = level;
+  atomic_store(&propagator.next, 0);
+  atomic_store(&propagator.fix, false);
+  propagator.running = propagator.count;
+  ++propagator.phase;
+  pthread_cond_broadcast(&propagator.wake);
+  pthread_mutex_unlock(&propagator.lock);
+
+  propagator_units();
+
+  pthread_mutex_lock(&propagator.lock);
+  while (propagator.running > 0)
+    pthread_cond_wait(&propagator.done, &propagator.lock);
+  pthread_mutex_unlock(&propagator.lock);
+  return atomic_load(&propagator.fix);
+}
+
+bool grid_set_threads (const size_t threads)
+{
+  if (propagator.count) {
+    pthread_mutex_lock(&propagator.lock);
+    propagator.quit = true;
+    pthread_cond_broadcast(&propagator.wake);
+    pthread_mutex_unlock(&propagator.lock);
+    for (size_t i = 0; i < propagator.count; ++i)
+      pthread_join(propagator.threads[i], NULL);
+    free(propagator.threads);
+    propagator.threads = NULL;
+    propagator.count = 0;
+    propagator.quit = false;
+  }
+  if (threads <= 1)
+    return true;
+
+  propagator.threads = malloc((threads - 1) * sizeof(pthread_t));
+  if (!propagator.threads)
+    return false;
+  for (size_t i = 0; i < threads - 1; ++i) {
+    if (pthread_create(&propagator.threads[i], NULL, propagator_worker,
+                       NULL) != 0) {
+      grid_set_threads(1);
       return false;
     }
+    ++propagator.count;
   }
-  free(subgrid);
   return true;
 }
 
 size_t grid_heuristics(grid_t *grid)
 { 
+  TRACE_SPAN("grid_heuristics");
   if (!grid)
     return NOT_CONSISTENT;
   if (grid->size == 1)
     return SOLVED;
   if (!grid_is_consistent(grid))
     return NOT_CONSISTENT;
+
+  /* Large grids go through all the rows, then all the columns, then all
+     the boxes, each phase shared with the propagation threads */
+  bool parallel = grid->size >= GRID_PARALLEL_SIZE && propagator.count &&
+                  pthread_mutex_trylock(&propagator.busy) == 0;
   
   size_t level = 0;
   while (level < 2) {
     bool fix = false;
-    colors_t *subgrid[grid->size];
-    for (size_t index = 0; index < grid->size; ++index) {
-      for (size_t i = 0; i < grid->size; ++i)
-        subgrid[i] = &grid->cells[index][i];
-      fix |= subgrid_heuristics(subgrid, grid->size, level);
-    
-      for (size_t i = 0; i < grid->size; ++i)
-        subgrid[i] = &grid->cells[i][index];
-      fix |= subgrid_heuristics(subgrid, grid->size, level);
-
-      size_t block_size = sqrt(grid->size);
-      size_t start_row = index / block_size * block_size;
-      size_t start_column = index % block_size * block_size;
-      size_t c = 0;
-      for (size_t i = start_row; i < start_row + block_size; ++i)
-        for (size_t j = start_column; j < start_column + block_size; ++j )
-          subgrid[c++] = &grid->cells[i][j];
-      fix |= subgrid_heuristics(subgrid, grid->size, level);
+    if (parallel) {
+      fix |= propagator_phase(grid, UNIT_ROW, level);
+      fix |= propagator_phase(grid, UNIT_COLUMN, level);
+      fix |= propagator_phase(grid, UNIT_BOX, level);
     }
+    else
+      for (size_t index = 0; index < grid->size; ++index) {
+        fix |= unit_heuristics(grid, UNIT_ROW, index, level);
+        fix |= unit_heuristics(grid, UNIT_COLUMN, index, level);
+        fix |= unit_heuristics(grid, UNIT_BOX, index, level);
+      }
     if (fix) {
       if (level == 1)
         --level;
@@ -252,11 +603,13 @@ size_t grid_heuristics(grid_t *grid)
     else
       ++level;
   }
+  if (parallel)
+    pthread_mutex_unlock(&propagator.busy);
+  if (!grid_is_consistent(grid))
+    return NOT_CONSISTENT;
   if (grid_is_solved(grid))
     return SOLVED;
-  if (grid_is_consistent(grid))
-    return CONSISTENT_NOT_SOLVED;
-  return NOT_CONSISTENT;
+  return CONSISTENT_NOT_SOLVED;
 }
 
 void grid_choice_free (choice_t *choice)
@@ -272,7 +625,7 @@ bool grid_choice_is_empty (const choice_t *choice)
   if (!choice)
     return true;
 
-  return choice->color == 0;
+  return colors_is_empty(choice->color);
 }
 
 void grid_choice_apply (grid_t *grid, const choice_t *choice)
@@ -301,21 +654,27 @@ void grid_choice_discard (grid_t *grid, const choice_t *choice)
   grid->cells[choice->row][choice->column] = cell;
 }
 
+bool grid_choice_is_last (const grid_t *grid, const choice_t *choice)
+{
+  if (!grid || !choice)
+    return false;
+
+  colors_t cell = grid->cells[choice->row][choice->column];
+  return colors_is_singleton(colors_subtract(cell, choice->color));
+}
+
 void grid_choice_print (const choice_t *choice, FILE *fd)
 {
-  fprintf(fd, "Choice : row %ld, column %ld, colors %ld \n",
-          choice->row, choice->column, choice->color);
+  fprintf(fd, "Choice : row %ld, column %ld, color %zu \n",
+          choice->row, choice->column, colors_index(choice->color));
 }
 
-choice_t *grid_choice (grid_t *grid, bool random)
+/* Find the first cell that is not a singleton, its color is left to the
+   caller to choose */
+static void grid_choice_cell (grid_t *grid, choice_t *choice)
 {
-  if (!grid)
-    return NULL;
-  choice_t *choice = malloc(sizeof(choice_t));
-  if (!choice)
-    return NULL;
-    
-  choice->color = 0;
+  TRACE_SPAN("grid_choice");
+  choice->color = colors_empty();
   choice->column = 0;
   choice->row = 0;
   for (size_t i = 0; i < grid->size; ++i)
@@ -329,6 +688,17 @@ choice_t *grid_choice (grid_t *grid, bool random)
       i = grid->size;
       j = grid->size;
     }
+}
+
+choice_t *grid_choice (grid_t *grid, bool random)
+{
+  if (!grid)
+    return NULL;
+  choice_t *choice = malloc(sizeof(choice_t));
+  if (!choice)
+    return NULL;
+
+  grid_choice_cell(grid, choice);
   if (random)
     choice->color = colors_random(choice->color);
   else
@@ -336,6 +706,67 @@ choice_t *grid_choice (grid_t *grid, bool random)
   return choice;
 }
 
+choice_t *grid_choice_r (grid_t *grid, uint64_t *seed)
+{
+  if (!grid)
+    return NULL;
+  choice_t *choice = malloc(sizeof(choice_t));
+  if (!choice)
+    return NULL;
+
+  grid_choice_into(grid, seed, choice);
+  return choice;
+}
+
+size_t grid_choice_sizeof (void)
+{
+  return sizeof(choice_t);
+}
+
+void grid_choice_into (grid_t *grid, uint64_t *seed, choice_t *choice)
+{
+  grid_choice_cell(grid, choice);
+  if (seed)
+    choice->color = colors_random_r(choice->color, seed);
+  else
+    choice->color = colors_leftmost(choice->color);
+}
+
+size_t grid_snapshot (const grid_t *grid, uint16_t *cells, colors_t *colors)
+{
+  const colors_t *all = grid->cells[0];
+  size_t count = 0;
+  for (size_t i = 0; i < grid->size * grid->size; ++i)
+    if (!colors_is_singleton(all[i])) {
+      cells[count] = i;
+      colors[count] = all[i];
+      ++count;
+    }
+  return count;
+}
+
+size_t grid_changes (const grid_t *grid, uint16_t *cells, colors_t *colors,
+                     const size_t count)
+{
+  const colors_t *all = grid->cells[0];
+  size_t changed = 0;
+  for (size_t i = 0; i < count; ++i)
+    if (!colors_is_equal(all[cells[i]], colors[i])) {
+      cells[changed] = cells[i];
+      colors[changed] = colors[i];
+      ++changed;
+    }
+  return changed;
+}
+
+void grid_restore (grid_t *grid, const uint16_t *cells,
+                   const colors_t *colors, const size_t count)
+{
+  colors_t *all = grid->cells[0];
+  for (size_t i = count; i > 0; --i)
+    all[cells[i - 1]] = colors[i - 1];
+}
+
 void grid_initialize (grid_t *grid)
 { 
   /* PRNG need to be initialized with srand() before calling this function */
@@ -350,3 +781,70 @@ void grid_initialize (grid_t *grid)
   }
 }
 
+void grid_initialize_r (grid_t *grid, uint64_t *seed)
+{
+  for (size_t i = 0; i < grid->size; ++i)
+    grid->cells[0][i] = colors_set(i);
+
+  for (size_t i = grid->size - 1; i > 0; --i) {
+    size_t j = random_next(seed) % i;
+    colors_t temp = grid->cells[0][i];
+    grid->cells[0][i] = grid->cells[0][j];
+    grid->cells[0][j] = temp;
+  }
+}
+
+/* Random permutation of 0..length-1 */
+static void shuffle (size_t *values, const size_t length, uint64_t *seed)
+{
+  for (size_t i = 0; i < length; ++i)
+    values[i] = i;
+  for (size_t i = length; i > 1; --i) {
+    size_t j = random_next(seed) % i;
+    size_t temp = values[i - 1];
+    values[i - 1] = values[j];
+    values[j] = temp;
+  }
+}
+
+/* Random permutation of the lines that keeps the bands (or the stacks) */
+static void shuffle_lines (size_t *lines, const size_t block, uint64_t *seed)
+{
+  size_t blocks[block];
+  size_t inner[block];
+  shuffle(blocks, block, seed);
+  for (size_t i = 0; i < block; ++i) {
+    shuffle(inner, block, seed);
+    for (size_t k = 0; k < block; ++k)
+      lines[i * block + k] = blocks[i] * block + inner[k];
+  }
+}
+
+void grid_fill_r (grid_t *grid, uint64_t *seed)
+{
+  size_t n = grid->size;
+  size_t block = 1;
+  while (block * block < n)
+    ++block;
+
+  size_t colors[n];
+  size_t rows[n];
+  size_t columns[n];
+  shuffle(colors, n, seed);
+  shuffle_lines(rows, block, seed);
+  shuffle_lines(columns, block, seed);
+  bool transpose = random_next(seed) & 1;
+
+  /* Each row of the pattern is the previous one shifted by a block, and
+     the first row of a band is the one of the previous band shifted by 1 */
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < n; ++j) {
+      size_t row = rows[i];
+      size_t column = columns[j];
+      size_t color = (block * (row % block) + row / block + column) % n;
+      if (transpose)
+        grid->cells[j][i] = colors_set(colors[color]);
+      else
+        grid->cells[i][j] = colors_set(colors[color]);
+    }
+}
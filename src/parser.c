@@ -0,0 +1,281 @@
+#include "grid.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+/* Read the next character of the buffer, EOF at its end */
+static int parser_getc (const char *buffer, size_t length, size_t *index)
+{
+  if (*index >= length)
+    return EOF;
+  return (unsigned char) buffer[(*index)++];
+}
+
+/* Write an error message in the caller's buffer */
+static void parser_error (char *error, size_t error_size, const char *format, ...)
+{
+  if (!error || error_size == 0)
+    return;
+
+  va_list args;
+  va_start(args, format);
+  vsnprintf(error, error_size, format, args);
+  va_end(args);
+}
+
+/* Number of blank-separated words of the first line holding cells */
+static size_t parser_words (const char *buffer, size_t length)
+{
+  size_t words = 0;
+  bool word = false;
+  for (size_t i = 0; i < length; ++i) {
+    char ch = buffer[i];
+    if (ch == '\n' && words > 0)
+      break;
+    if (ch == '#') {
+      while (i < length && buffer[i] != '\n')
+        ++i;
+      --i;
+      word = false;
+      continue;
+    }
+    if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n')
+      word = false;
+    else if (!word) {
+      word = true;
+      ++words;
+    }
+  }
+  return words;
+}
+
+/* Parse a grid of size N in the numeric syntax: each line holds N words,
+   colors from 1 to N or EMPTY_CELL, comments are the same as in the
+   character syntax */
+static grid_t *parser_numeric (const char *buffer, size_t length,
+                               const size_t size, char *error,
+                               size_t error_size)
+{
+  grid_t *grid = grid_alloc(size);
+  if (!grid) {
+    parser_error(error, error_size, "grid size %zu is not supported!", size);
+    return NULL;
+  }
+
+  size_t row = 0;
+  size_t line = 1;
+  for (size_t index = 0; index < length; index++, line++) {
+    size_t end = index;
+    while (end < length && buffer[end] != '\n')
+      ++end;
+
+    size_t column = 0;
+    size_t i = index;
+    while (i < end && buffer[i] != '#') {
+      if (strchr(" \t\r", buffer[i])) {
+        ++i;
+        continue;
+      }
+      size_t start = i;
+      while (i < end && !strchr(" \t\r#", buffer[i]))
+        ++i;
+      if (row >= size) {
+        parser_error(error, error_size,
+                     "grid has extra lines starting from line %zu!", line);
+        grid_free(grid);
+        return NULL;
+      }
+      if (column >= size) {
+        parser_error(error, error_size,
+                     "line %zu is malformed! (wrong number of columns)", line);
+        grid_free(grid);
+        return NULL;
+      }
+
+      size_t color = 0;
+      bool valid = true;
+      for (size_t k = start; k < i && valid; ++k) {
+        valid = buffer[k] >= '0' && buffer[k] <= '9';
+        color = 10 * color + (buffer[k] - '0');
+        valid = valid && color <= size;
+      }
+      if (i - start == 1 && buffer[start] == EMPTY_CELL)
+        grid_set_colors(grid, row, column, colors_full(size));
+      else if (valid && color > 0)
+        grid_set_colors(grid, row, column, colors_set(color - 1));
+      else {
+        parser_error(error, error_size, "wrong color '%.*s' at line %zu!",
+                     (int) (i - start), buffer + start, line);
+        grid_free(grid);
+        return NULL;
+      }
+      ++column;
+    }
+
+    if (column == size)
+      ++row;
+    else if (column > 0) {
+      parser_error(error, error_size,
+                   "line %zu is malformed! (wrong number of columns)", line);
+      grid_free(grid);
+      return NULL;
+    }
+    index = end;
+  }
+
+  if (row < size) {
+    parser_error(error, error_size, "grid has %zu missing line(s)",
+                 size - row);
+    grid_free(grid);
+    return NULL;
+  }
+  return grid;
+}
+
+grid_t *grid_parse (const char *buffer, size_t length,
+                    char *error, size_t error_size)
+{
+  /* Rows too long for color_table are in the numeric syntax */
+  size_t words = parser_words(buffer, length);
+  if (words > COLOR_TABLE_SIZE)
+    return parser_numeric(buffer, length, words, error, error_size);
+
+  char first_row[COLOR_TABLE_SIZE];
+  size_t index = 0;
+  int ch;
+  size_t n = 0;
+  size_t line = 1;
+  bool comment = false;
+  bool exit = false;
+  while(!exit) {
+    ch = parser_getc(buffer, length, &index);
+
+    if (ch == EOF) {
+      line++;
+      break;
+    }
+
+    if (ch == '\n') {
+      line++;
+      if (n > 0)
+        break;
+      comment = false;
+      continue;
+    }
+
+    if (!comment) {
+      switch (ch) {
+        case ' ':
+        case '\t':
+        case '\r':
+          break;
+
+        case '#':
+          comment = true;
+          break;
+
+        default:
+          if (n == COLOR_TABLE_SIZE) {
+            parser_error(error, error_size,
+                         "line %zu is malformed! (exceed max size)", line);
+            return NULL;
+          }
+          first_row[n++] = ch;
+          break;
+      }
+    }
+  }
+
+  if (n == 0) {
+    parser_error(error, error_size, "Grid is empty");
+    return NULL;
+  }
+
+  grid_t *grid = grid_alloc(n);
+  if (!grid) {
+    parser_error(error, error_size, "Can't allocate new grid!");
+    return NULL;
+  }
+
+  for (size_t i = 0; i < n; i++)
+    if (grid_check_char(grid, first_row[i]))
+      grid_set_cell(grid, 0, i, first_row[i]);
+    else {
+      parser_error(error, error_size, "wrong character '%c' at line %zu!",
+                   first_row[i], line - 1);
+      grid_free(grid);
+      return NULL;
+    }
+  size_t row = 1;
+
+  n = 0;
+  comment = false;
+  while(true) {
+    ch = parser_getc(buffer, length, &index);
+
+    if (ch == '\n' || ch == EOF) {
+      comment = false;
+      if (n == grid_get_size(grid)) {
+        row++;
+        n = 0;
+      }
+      else if (n > 0) {
+        parser_error(error, error_size,
+                     "line %zu is malformed! (wrong number of columns)", line);
+        grid_free(grid);
+        return NULL;
+      }
+      if (ch == EOF)
+        break;
+      line++;
+      continue;
+    }
+    if (!comment) {
+      switch (ch) {
+        case ' ':
+        case '\t':
+        case '\r':
+          break;
+
+        case '#':
+          comment = true;
+          break;
+
+        default:
+          if (n >= grid_get_size(grid)) {
+            parser_error(error, error_size,
+                         "line %zu is malformed! (wrong number of columns)",
+                         line);
+            grid_free(grid);
+            return NULL;
+          }
+          if (row >= grid_get_size(grid)) {
+            parser_error(error, error_size,
+                         "grid has extra lines starting from line %zu!", line);
+            grid_free(grid);
+            return NULL;
+          }
+          if (grid_check_char(grid, ch)) {
+            grid_set_cell(grid, row, n, ch);
+            n++;
+          }
+          else {
+            parser_error(error, error_size, "wrong character '%c' at line %zu!",
+                         ch, line);
+            grid_free(grid);
+            return NULL;
+          }
+          break;
+      }
+    }
+  }
+
+  if (row < grid_get_size(grid)) {
+    parser_error(error, error_size, "grid has %zu missing line(s)",
+                 grid_get_size(grid) - row);
+    grid_free(grid);
+    return NULL;
+  }
+
+  return grid;
+}
@@ -0,0 +1,567 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "server.h"
+
+#include "cache.h"
+#include "grid.h"
+#include "session.h"
+#include "solver.h"
+#include "store.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <err.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define ID_SEPARATORS " \t\r\n"
+
+typedef enum
+{
+  command_solve, command_all, command_count, command_generate
+} command_t;
+
+/* Client connection, shared by its reader thread and its pending jobs */
+typedef struct
+{
+  int fd;
+  pthread_mutex_t lock;
+  size_t references;
+} connection_t;
+
+/* Request waiting for a worker */
+typedef struct job_t job_t;
+struct job_t
+{
+  job_t *next;
+  connection_t *connection;
+  command_t command;
+  char *id;
+  char *grid;
+  size_t length;
+  size_t size;
+  bool unique;
+};
+
+/* Requests of all connections, in arrival order */
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  job_t *head;
+  job_t *tail;
+} queue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL };
+
+static void queue_push (job_t *job)
+{
+  pthread_mutex_lock(&queue.lock);
+  job->next = NULL;
+  if (queue.tail)
+    queue.tail->next = job;
+  else
+    queue.head = job;
+  queue.tail = job;
+  pthread_cond_signal(&queue.ready);
+  pthread_mutex_unlock(&queue.lock);
+}
+
+static job_t *queue_pop (void)
+{
+  pthread_mutex_lock(&queue.lock);
+  while (!queue.head)
+    pthread_cond_wait(&queue.ready, &queue.lock);
+  job_t *job = queue.head;
+  queue.head = job->next;
+  if (!queue.head)
+    queue.tail = NULL;
+  pthread_mutex_unlock(&queue.lock);
+  return job;
+}
+
+static void job_free (job_t *job)
+{
+  free(job->id);
+  free(job->grid);
+  free(job);
+}
+
+static void connection_acquire (connection_t *connection)
+{
+  pthread_mutex_lock(&connection->lock);
+  ++connection->references;
+  pthread_mutex_unlock(&connection->lock);
+}
+
+static void connection_release (connection_t *connection)
+{
+  pthread_mutex_lock(&connection->lock);
+  bool last = --connection->references == 0;
+  pthread_mutex_unlock(&connection->lock);
+  if (!last)
+    return;
+
+  close(connection->fd);
+  pthread_mutex_destroy(&connection->lock);
+  free(connection);
+}
+
+/* Write a whole response, responses of concurrent jobs are not mixed */
+static void connection_send (connection_t *connection, const char *data,
+                             size_t length)
+{
+  pthread_mutex_lock(&connection->lock);
+  while (length > 0) {
+    ssize_t n = write(connection->fd, data, length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    data += n;
+    length -= n;
+  }
+  pthread_mutex_unlock(&connection->lock);
+}
+
+static void connection_error (connection_t *connection, const char *id,
+                              const char *message)
+{
+  char response[256];
+  int length = snprintf(response, sizeof(response), "%s error %s\n.\n",
+                        id, message);
+  if (length >= (int) sizeof(response))
+    length = sizeof(response) - 1;
+  if (length > 0)
+    connection_send(connection, response, length);
+}
+
+/* Solution callback writing each solution in the response */
+static bool solution_printer (const grid_t *solution, void *data)
+{
+  grid_print(solution, data);
+  return true;
+}
+
+/* Run a job and write its response in out */
+static void job_run (solver_t *solver, const job_t *job, FILE *out)
+{
+  char *text = NULL;
+  size_t length = 0;
+  FILE *grids = open_memstream(&text, &length);
+  if (!grids) {
+    fprintf(out, "%s error out of memory!\n.\n", job->id);
+    return;
+  }
+
+  char error[128] = "";
+  size_t count = 0;
+  if (job->command == command_generate) {
+    solver_status_t status;
+    grid_t *grid = solver_generate(solver, job->size, job->unique, &status);
+    if (status == SOLVER_OUT_OF_MEMORY)
+      snprintf(error, sizeof(error), "memory limit reached, generation "
+               "aborted!");
+    else if (status == SOLVER_UNKNOWN)
+      snprintf(error, sizeof(error), "budget exceeded, generation aborted!");
+    else if (grid) {
+      grid_print(grid, grids);
+      count = 1;
+    }
+    else
+      snprintf(error, sizeof(error), "can't generate a grid of size %zu!",
+               job->size);
+    grid_free(grid);
+  }
+  else {
+    grid_t *grid = grid_parse(job->grid, job->length, error, sizeof(error));
+    if (grid) {
+      solver_mode_t mode = mode_first;
+      if (job->command == command_all)
+        mode = mode_all;
+      else if (job->command == command_count)
+        mode = mode_count;
+      solver_set_mode(solver, mode);
+      solver_set_random(solver, (mode == mode_first) ? true : false);
+      solver_set_callback(solver, solution_printer, grids);
+      solver_status_t status = solver_solve(solver, grid);
+      if (status == SOLVER_OUT_OF_MEMORY)
+        snprintf(error, sizeof(error), "memory limit reached, search aborted!");
+      else if (status == SOLVER_UNKNOWN)
+        snprintf(error, sizeof(error), "budget exceeded, search aborted!");
+      count = solver_get_solutions(solver);
+      grid_free(grid);
+    }
+  }
+  fclose(grids);
+
+  if (error[0])
+    fprintf(out, "%s error %s\n", job->id, error);
+  else {
+    fprintf(out, "%s ok %zu\n", job->id, count);
+    fwrite(text, 1, length, out);
+  }
+  fputs(".\n", out);
+  free(text);
+}
+
+static void *worker_main (void *data)
+{
+  solver_t *solver = data;
+  while (true) {
+    job_t *job = queue_pop();
+    char *response = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&response, &length);
+    if (out) {
+      job_run(solver, job, out);
+      fclose(out);
+      connection_send(job->connection, response, length);
+      free(response);
+    }
+    else
+      connection_error(job->connection, job->id, "out of memory!");
+    connection_release(job->connection);
+    job_free(job);
+  }
+  return NULL;
+}
+
+/* Read the grid of a request, up to the line holding a single '.' */
+static bool grid_reader (FILE *in, job_t *job)
+{
+  char *line = NULL;
+  size_t capacity = 0;
+  size_t allocated = 0;
+  ssize_t n;
+  bool terminated = false;
+  while ((n = getline(&line, &capacity, in)) > 0) {
+    size_t end = strcspn(line, "\r\n");
+    if (end == 1 && line[0] == '.') {
+      terminated = true;
+      break;
+    }
+    if (job->length + n > allocated) {
+      allocated = 2 * (job->length + n);
+      char *grid = realloc(job->grid, allocated);
+      if (!grid)
+        break;
+      job->grid = grid;
+    }
+    memcpy(job->grid + job->length, line, n);
+    job->length += n;
+  }
+  free(line);
+  return terminated;
+}
+
+/* Messages of the session outcomes that are errors */
+static const char *session_error (const session_status_t status)
+{
+  switch (status) {
+    case SESSION_INVALID:
+      return "invalid cell or color!";
+    case SESSION_CLUE:
+      return "the cell is a clue!";
+    case SESSION_CONFLICT:
+      return "the color is already in the row, column or box!";
+    case SESSION_STUCK:
+      return "no cell can be deduced, a guess is needed!";
+    case SESSION_SOLVED:
+      return "the grid is solved!";
+    default:
+      return NULL;
+  }
+}
+
+/* Run a session command of the connection, they are cheap and must keep
+   their order, so they are answered by its reader thread. False if the
+   connection must be closed. */
+static bool session_command (connection_t *connection, session_t **session,
+                             job_t *job, const char *command, char **save,
+                             FILE *in)
+{
+  char response[256];
+  const char *error = NULL;
+  size_t numbers[3] = { 0, 0, 0 };
+  for (size_t i = 0; i < 3; ++i) {
+    char *argument = strtok_r(NULL, ID_SEPARATORS, save);
+    numbers[i] = argument ? strtoul(argument, NULL, 10) : 0;
+  }
+
+  if (!strcmp(command, "open")) {
+    if (!grid_reader(in, job)) {
+      connection_error(connection, job->id, "grid is not terminated by '.'!");
+      return false;
+    }
+    char message[128];
+    grid_t *grid = grid_parse(job->grid, job->length, message,
+                              sizeof(message));
+    if (!grid) {
+      connection_error(connection, job->id, message);
+      return true;
+    }
+    session_t *opened = session_new(grid);
+    grid_free(grid);
+    if (!opened) {
+      connection_error(connection, job->id, "clues conflict or out of memory!");
+      return true;
+    }
+    session_free(*session);
+    *session = opened;
+  }
+  else if (!*session)
+    error = "no open session!";
+  else if (!strcmp(command, "set"))
+    error = session_error(session_set(*session, numbers[0] - 1,
+                                      numbers[1] - 1, numbers[2] - 1));
+  else if (!strcmp(command, "clear"))
+    error = session_error(session_clear(*session, numbers[0] - 1,
+                                        numbers[1] - 1));
+  else if (!strcmp(command, "hint")) {
+    hint_t hint;
+    session_status_t status = session_hint(*session, &hint);
+    if (status == SESSION_CONFLICT)
+      error = "a cell has no candidate left!";
+    else if (status != SESSION_OK)
+      error = session_error(status);
+    else {
+      int length;
+      if (hint.unit)
+        length = snprintf(response, sizeof(response),
+                          "%s ok 0 %zu %zu %zu %s %s %zu\n.\n", job->id,
+                          hint.row + 1, hint.column + 1, hint.color + 1,
+                          hint.technique, hint.unit, hint.index + 1);
+      else
+        length = snprintf(response, sizeof(response),
+                          "%s ok 0 %zu %zu %zu %s\n.\n", job->id,
+                          hint.row + 1, hint.column + 1, hint.color + 1,
+                          hint.technique);
+      if (length > 0 && length < (int) sizeof(response))
+        connection_send(connection, response, length);
+      else
+        connection_error(connection, job->id, "hint is too long!");
+      return true;
+    }
+  }
+  else if (!strcmp(command, "show")) {
+    char *text = NULL;
+    size_t length = 0;
+    FILE *out = open_memstream(&text, &length);
+    if (!out) {
+      connection_error(connection, job->id, "out of memory!");
+      return true;
+    }
+    fprintf(out, "%s ok 1\n", job->id);
+    grid_print(session_get_grid(*session), out);
+    fputs(".\n", out);
+    fclose(out);
+    connection_send(connection, text, length);
+    free(text);
+    return true;
+  }
+
+  if (error)
+    connection_error(connection, job->id, error);
+  else {
+    int length = snprintf(response, sizeof(response), "%s ok 0\n.\n",
+                          job->id);
+    if (length > 0 && length < (int) sizeof(response))
+      connection_send(connection, response, length);
+  }
+  return true;
+}
+
+static void *connection_main (void *data)
+{
+  connection_t *connection = data;
+  int fd = dup(connection->fd);
+  FILE *in = (fd < 0) ? NULL : fdopen(fd, "r");
+  if (!in) {
+    if (fd >= 0)
+      close(fd);
+    connection_release(connection);
+    return NULL;
+  }
+
+  session_t *session = NULL;
+  char *line = NULL;
+  size_t capacity = 0;
+  while (getline(&line, &capacity, in) > 0) {
+    char *save;
+    char *id = strtok_r(line, ID_SEPARATORS, &save);
+    if (!id)
+      continue;
+    char *command = strtok_r(NULL, ID_SEPARATORS, &save);
+
+    job_t *job = calloc(1, sizeof(job_t));
+    if (job)
+      job->id = strdup(id);
+    if (!job || !job->id) {
+      connection_error(connection, id, "out of memory!");
+      free(job);
+      continue;
+    }
+    job->connection = connection;
+    if (command && (!strcmp(command, "solve") || !strcmp(command, "all") ||
+                    !strcmp(command, "count"))) {
+      job->command = command_solve;
+      if (!strcmp(command, "all"))
+        job->command = command_all;
+      else if (!strcmp(command, "count"))
+        job->command = command_count;
+      if (!grid_reader(in, job)) {
+        connection_error(connection, id, "grid is not terminated by '.'!");
+        job_free(job);
+        break;
+      }
+    }
+    else if (command && !strcmp(command, "generate")) {
+      job->command = command_generate;
+      job->size = 9;
+      char *argument;
+      while ((argument = strtok_r(NULL, ID_SEPARATORS, &save))) {
+        if (!strcmp(argument, "unique"))
+          job->unique = true;
+        else {
+          char *end;
+          job->size = strtoul(argument, &end, 10);
+          if (*argument < '0' || *argument > '9' || *end != '\0')
+            job->size = 0;
+        }
+      }
+      if (!grid_check_size(job->size)) {
+        connection_error(connection, id,
+                         "invalid grid size, only (" GRID_SIZES ")!");
+        job_free(job);
+        continue;
+      }
+    }
+    else if (command && (!strcmp(command, "open") ||
+                         !strcmp(command, "set") ||
+                         !strcmp(command, "clear") ||
+                         !strcmp(command, "hint") ||
+                         !strcmp(command, "show"))) {
+      bool alive = session_command(connection, &session, job, command, &save,
+                                   in);
+      job_free(job);
+      if (!alive)
+        break;
+      continue;
+    }
+    else {
+      connection_error(connection, id, "unknown command!");
+      job_free(job);
+      continue;
+    }
+    connection_acquire(connection);
+    queue_push(job);
+  }
+  free(line);
+  session_free(session);
+  fclose(in);
+  connection_release(connection);
+  return NULL;
+}
+
+bool server_run (const char *path, const server_options_t *options)
+{
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    warnx("error: socket path %s is too long!", path);
+    return false;
+  }
+  strcpy(address.sun_path, path);
+
+  /* A client leaving early must not kill the daemon */
+  signal(SIGPIPE, SIG_IGN);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    warn("error: can't create socket");
+    return false;
+  }
+  unlink(path);
+  if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    warn("error: can't listen on %s", path);
+    close(fd);
+    return false;
+  }
+
+  cache_t *cache = NULL;
+  if (options->cache) {
+    cache = cache_new(options->cache);
+    if (!cache)
+      warnx("warning: can't allocate the cache, disabled");
+  }
+
+  /* A new store is created for 9x9 grids, the size of the requests isn't
+     known yet */
+  store_t *store = NULL;
+  if (options->store) {
+    store = store_open(options->store, 9);
+    if (!store)
+      warnx("warning: can't open the disk cache %s, disabled", options->store);
+  }
+
+  size_t workers = options->workers;
+  if (workers == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = (online > 0) ? online : 1;
+  }
+  for (size_t i = 0; i < workers; ++i) {
+    solver_t *solver = solver_new();
+    if (!solver) {
+      warnx("error: can't allocate the solver!");
+      close(fd);
+      return false;
+    }
+    solver_set_memory_limit(solver, options->memory_limit);
+    solver_set_timeout(solver, options->timeout);
+    solver_set_max_nodes(solver, options->max_nodes);
+    solver_set_cache(solver, cache);
+    solver_set_store(solver, store);
+    solver_set_seed(solver, options->seed + i);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker_main, solver)) {
+      warnx("error: can't start worker %zu!", i);
+      solver_free(solver);
+      close(fd);
+      return false;
+    }
+    pthread_detach(thread);
+  }
+
+  while (true) {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      warn("error: can't accept connection");
+      break;
+    }
+
+    connection_t *connection = malloc(sizeof(connection_t));
+    if (!connection) {
+      close(client);
+      continue;
+    }
+    connection->fd = client;
+    connection->references = 1;
+    pthread_mutex_init(&connection->lock, NULL);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, connection_main, connection)) {
+      connection_release(connection);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  close(fd);
+  return false;
+}
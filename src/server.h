@@ -0,0 +1,53 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Solver daemon on a Unix domain socket.
+
+   A request is a header line "ID COMMAND [ARGUMENTS]", where ID is any word
+   chosen by the client to match the response:
+     ID solve            first solution of the grid that follows
+     ID all              every solution of the grid that follows
+     ID count            number of solutions of the grid that follows
+     ID generate [N] [unique]
+                         generate a grid of size NxN (default: 9)
+   The grid of solve, all and count is written in the same text format as the
+   input files, and terminated by a line holding a single '.'.
+
+   Each response starts with "ID ok COUNT" followed by COUNT grids (none for
+   count), or with "ID error MESSAGE", and is terminated by a line holding a
+   single '.'.
+   Clients may send several requests without waiting: they are handled
+   concurrently and responses come back in completion order.
+
+   A connection may also play an interactive session on a grid, its
+   commands are answered in order:
+     ID open             start a session on the grid that follows
+     ID set ROW COLUMN COLOR
+                         set a cell, rows, columns and colors from 1
+     ID clear ROW COLUMN clear a cell
+     ID hint             next deducible cell: "ID ok 0 ROW COLUMN COLOR
+                         TECHNIQUE UNIT INDEX", UNIT being row, column or box,
+                         or "ID ok 0 ROW COLUMN COLOR naked_single" for a
+                         cell its units leave with a single candidate
+     ID show             the candidates of every cell, as one grid */
+
+/* Options of the daemon */
+typedef struct
+{
+  size_t workers;       /* number of solver threads */
+  size_t memory_limit;  /* memory limit of each search, 0 for no limit */
+  size_t timeout;       /* time limit of each request in ms, 0 for none */
+  size_t max_nodes;     /* node limit of each request, 0 for no limit */
+  size_t cache;         /* results shared by the workers, 0 for no cache */
+  const char *store;    /* file of the persistent results, NULL for none */
+  uint64_t seed;        /* seed of the PRNG of the first worker */
+} server_options_t;
+
+/* Listen on the socket path and serve requests, only returns on error */
+bool server_run (const char *path, const server_options_t *options);
+
+#endif /* SERVER_H */
@@ -0,0 +1,280 @@
+#include "session.h"
+
+#include "colors.h"
+
+#include <math.h>
+#include <string.h>
+
+struct session_t
+{
+  size_t size;
+  size_t block;
+  grid_t *grid;
+  uint8_t *values;  /* color + 1 of the clues and of the cells set, or 0 */
+  bool *clues;
+};
+
+/* Subgrid techniques of the hints, simplest first */
+static const struct
+{
+  const char *name;
+  bool (*apply) (colors_t *subgrid[], size_t size);
+} techniques[] = {
+  { "cross_hatching", cross_hatching },
+  { "lone_number", lone_number },
+  { "naked_subset", naked_subset },
+  { "hidden_subset", hidden_subset }
+};
+
+#define TECHNIQUES (sizeof(techniques) / sizeof(techniques[0]))
+
+static const char *const unit_names[] = { "row", "column", "box" };
+
+/* Cells of unit u: the rows, then the columns, then the boxes */
+static void session_unit (const session_t *session, const size_t u,
+                          size_t cells[])
+{
+  size_t size = session->size;
+  size_t block = session->block;
+  size_t index = u % size;
+  for (size_t i = 0; i < size; ++i)
+    if (u < size)
+      cells[i] = index * size + i;
+    else if (u < 2 * size)
+      cells[i] = i * size + index;
+    else
+      cells[i] = (index / block * block + i / block) * size +
+                 index % block * block + i % block;
+}
+
+/* The row, the column and the box of a cell */
+static void session_units (const session_t *session, const size_t cell,
+                           size_t units[3])
+{
+  size_t size = session->size;
+  size_t block = session->block;
+  size_t row = cell / size;
+  size_t column = cell % size;
+  units[0] = row;
+  units[1] = size + column;
+  units[2] = 2 * size + row / block * block + column / block;
+}
+
+/* Whether a unit of the cell holds the color in another cell */
+static bool session_holds (const session_t *session, const size_t cell,
+                           const size_t color)
+{
+  size_t units[3];
+  size_t cells[session->size];
+  session_units(session, cell, units);
+  for (size_t u = 0; u < 3; ++u) {
+    session_unit(session, units[u], cells);
+    for (size_t i = 0; i < session->size; ++i)
+      if (cells[i] != cell && session->values[cells[i]] == color + 1)
+        return true;
+  }
+  return false;
+}
+
+/* Colors held by no unit of an empty cell */
+static colors_t session_candidates (const session_t *session,
+                                    const size_t cell)
+{
+  size_t units[3];
+  size_t cells[session->size];
+  colors_t candidates = colors_full(session->size);
+  session_units(session, cell, units);
+  for (size_t u = 0; u < 3; ++u) {
+    session_unit(session, units[u], cells);
+    for (size_t i = 0; i < session->size; ++i)
+      if (session->values[cells[i]])
+        candidates = colors_discard(candidates,
+                                    session->values[cells[i]] - 1);
+  }
+  return candidates;
+}
+
+session_t *session_new (const grid_t *puzzle)
+{
+  if (!puzzle)
+    return NULL;
+
+  session_t *session = malloc(sizeof(session_t));
+  if (!session)
+    return NULL;
+  size_t size = grid_get_size(puzzle);
+  session->size = size;
+  session->block = sqrt(size);
+  session->grid = grid_alloc(size);
+  session->values = calloc(size * size, sizeof(uint8_t));
+  session->clues = calloc(size * size, sizeof(bool));
+  if (!session->grid || !session->values || !session->clues) {
+    session_free(session);
+    return NULL;
+  }
+
+  for (size_t cell = 0; cell < size * size; ++cell) {
+    colors_t colors = grid_get_colors(puzzle, cell / size, cell % size);
+    if (colors_is_singleton(colors)) {
+      session->values[cell] = colors_index(colors) + 1;
+      session->clues[cell] = true;
+    }
+  }
+  for (size_t cell = 0; cell < size * size; ++cell) {
+    size_t value = session->values[cell];
+    if (value && session_holds(session, cell, value - 1)) {
+      session_free(session);
+      return NULL;
+    }
+    grid_set_colors(session->grid, cell / size, cell % size,
+                    value ? colors_set(value - 1)
+                          : session_candidates(session, cell));
+  }
+  return session;
+}
+
+void session_free (session_t *session)
+{
+  if (!session)
+    return;
+
+  grid_free(session->grid);
+  free(session->values);
+  free(session->clues);
+  free(session);
+}
+
+const grid_t *session_get_grid (const session_t *session)
+{
+  return session->grid;
+}
+
+session_status_t session_set (session_t *session, const size_t row,
+                              const size_t column, const size_t color)
+{
+  size_t size = session->size;
+  if (row >= size || column >= size || color >= size)
+    return SESSION_INVALID;
+  size_t cell = row * size + column;
+  if (session->clues[cell])
+    return SESSION_CLUE;
+  if (session_holds(session, cell, color))
+    return SESSION_CONFLICT;
+
+  if (session->values[cell])
+    session_clear(session, row, column);
+  session->values[cell] = color + 1;
+  grid_set_colors(session->grid, row, column, colors_set(color));
+
+  /* Only the empty cells of its units lose the color */
+  size_t units[3];
+  size_t cells[size];
+  session_units(session, cell, units);
+  for (size_t u = 0; u < 3; ++u) {
+    session_unit(session, units[u], cells);
+    for (size_t i = 0; i < size; ++i) {
+      size_t peer = cells[i];
+      if (session->values[peer])
+        continue;
+      colors_t colors = grid_get_colors(session->grid, peer / size,
+                                        peer % size);
+      grid_set_colors(session->grid, peer / size, peer % size,
+                      colors_discard(colors, color));
+    }
+  }
+  return SESSION_OK;
+}
+
+session_status_t session_clear (session_t *session, const size_t row,
+                                const size_t column)
+{
+  size_t size = session->size;
+  if (row >= size || column >= size)
+    return SESSION_INVALID;
+  size_t cell = row * size + column;
+  if (session->clues[cell])
+    return SESSION_CLUE;
+  if (!session->values[cell])
+    return SESSION_OK;
+
+  size_t color = session->values[cell] - 1;
+  session->values[cell] = 0;
+  grid_set_colors(session->grid, row, column,
+                  session_candidates(session, cell));
+
+  /* The empty cells of its units get the color back, unless another of
+     their units still holds it */
+  size_t units[3];
+  size_t cells[size];
+  session_units(session, cell, units);
+  for (size_t u = 0; u < 3; ++u) {
+    session_unit(session, units[u], cells);
+    for (size_t i = 0; i < size; ++i) {
+      size_t peer = cells[i];
+      if (peer == cell || session->values[peer] ||
+          session_holds(session, peer, color))
+        continue;
+      colors_t colors = grid_get_colors(session->grid, peer / size,
+                                        peer % size);
+      grid_set_colors(session->grid, peer / size, peer % size,
+                      colors_add(colors, color));
+    }
+  }
+  return SESSION_OK;
+}
+
+session_status_t session_hint (const session_t *session, hint_t *hint)
+{
+  size_t size = session->size;
+  colors_t cells[size * size];
+  bool filled = true;
+  for (size_t cell = 0; cell < size * size; ++cell) {
+    cells[cell] = grid_get_colors(session->grid, cell / size, cell % size);
+    if (colors_is_empty(cells[cell]))
+      return SESSION_CONFLICT;
+    if (session->values[cell])
+      continue;
+    filled = false;
+
+    /* A cell left with one candidate by its units together, none of them
+       gives it alone */
+    if (colors_is_singleton(cells[cell])) {
+      *hint = (hint_t) { cell / size, cell % size, colors_index(cells[cell]),
+                         "naked_single", NULL, 0 };
+      return SESSION_OK;
+    }
+  }
+  if (filled)
+    return SESSION_SOLVED;
+
+  /* Apply the techniques to a copy of the candidates, going back to the
+     simplest one after each change, up to the first new singleton */
+  size_t unit[size];
+  colors_t *subgrid[size];
+  size_t t = 0;
+  while (t < TECHNIQUES) {
+    bool changed = false;
+    for (size_t u = 0; u < 3 * size && !changed; ++u) {
+      session_unit(session, u, unit);
+      for (size_t i = 0; i < size; ++i)
+        subgrid[i] = &cells[unit[i]];
+      if (!techniques[t].apply(subgrid, size))
+        continue;
+
+      changed = true;
+      for (size_t i = 0; i < size; ++i) {
+        size_t cell = unit[i];
+        if (colors_is_empty(cells[cell]))
+          return SESSION_CONFLICT;
+        if (!session->values[cell] && colors_is_singleton(cells[cell])) {
+          *hint = (hint_t) { cell / size, cell % size,
+                             colors_index(cells[cell]), techniques[t].name,
+                             unit_names[u / size], u % size };
+          return SESSION_OK;
+        }
+      }
+    }
+    t = changed ? 0 : t + 1;
+  }
+  return SESSION_STUCK;
+}
@@ -0,0 +1,1304 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "solver.h"
+
+#include "board.h"
+#include "cache.h"
+#include "canon.h"
+#include "colors.h"
+#include "trace.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+/* Search nodes between two checks of the clock and of the cancel flag */
+#define SOLVER_CHECK_INTERVAL 64
+
+/* Search nodes of the shortest run between two restarts */
+#define SOLVER_RESTART_UNIT 512
+
+/* Search node: the length of the trail when its choice was made, and the
+   choice currently explored from it, NULL before it is made. The choice
+   lives in the storage of its level, see solver_t. */
+typedef struct
+{
+  size_t mark;
+  choice_t *choice;
+} frame_t;
+
+struct solver_t
+{
+  solver_mode_t mode;
+  bool random;
+  uint64_t seed;
+  size_t memory_limit;
+  size_t timeout;
+  size_t max_nodes;
+  atomic_bool *cancel;
+  bool restarts;
+  size_t portfolio;
+  bool search_fill;
+  solver_callback_t callback;
+  void *data;
+  solver_progress_t progress;
+  size_t progress_interval;
+  void *progress_data;
+  cache_t *cache;
+  store_t *store;
+
+  grid_pool_t *pool;
+  board_t *board;
+  bool boarded;
+  grid_t *work;
+  frame_t *stack;
+  char *choices;  /* storage of the choice of each level of the stack */
+  size_t capacity;
+  size_t depth;
+  uint16_t *trail_cells;
+  colors_t *trail_colors;
+  size_t trail_capacity;
+  size_t trail_length;
+  size_t trail_saved;
+  bool out_of_memory;
+  bool stopped;
+  bool interrupted;
+  uint64_t deadline;
+  size_t budget;
+  size_t ticks;
+  size_t restart;
+  atomic_bool *race;
+  solver_t **workers;
+  size_t workers_count;
+
+  size_t solutions;
+  size_t nodes;
+  grid_t *solution;
+};
+
+solver_t *solver_new (void)
+{
+  solver_t *solver = malloc(sizeof(solver_t));
+  if (!solver)
+    return NULL;
+
+  solver->mode = mode_first;
+  solver->random = false;
+  solver->seed = 0;
+  solver->memory_limit = 0;
+  solver->timeout = 0;
+  solver->max_nodes = 0;
+  solver->cancel = NULL;
+  solver->restarts = false;
+  solver->portfolio = 1;
+  solver->search_fill = false;
+  solver->callback = NULL;
+  solver->data = NULL;
+  solver->progress = NULL;
+  solver->progress_interval = 0;
+  solver->progress_data = NULL;
+  solver->cache = NULL;
+  solver->store = NULL;
+  solver->pool = NULL;
+  solver->board = NULL;
+  solver->boarded = false;
+  solver->work = NULL;
+  solver->stack = NULL;
+  solver->choices = NULL;
+  solver->capacity = 0;
+  solver->depth = 0;
+  solver->trail_cells = NULL;
+  solver->trail_colors = NULL;
+  solver->trail_capacity = 0;
+  solver->trail_length = 0;
+  solver->trail_saved = 0;
+  solver->out_of_memory = false;
+  solver->stopped = false;
+  solver->interrupted = false;
+  solver->deadline = 0;
+  solver->budget = 0;
+  solver->ticks = 0;
+  solver->restart = 0;
+  solver->race = NULL;
+  solver->workers = NULL;
+  solver->workers_count = 0;
+  solver->solutions = 0;
+  solver->nodes = 0;
+  solver->solution = NULL;
+  return solver;
+}
+
+void solver_free (solver_t *solver)
+{
+  if (!solver)
+    return;
+
+  for (size_t i = 0; i < solver->workers_count; ++i)
+    solver_free(solver->workers[i]);
+  free(solver->workers);
+  free(solver->stack);
+  free(solver->choices);
+  free(solver->trail_cells);
+  free(solver->trail_colors);
+  grid_pool_free(solver->pool);
+  board_free(solver->board);
+  grid_free(solver->solution);
+  free(solver);
+}
+
+void solver_set_mode (solver_t *solver, const solver_mode_t mode)
+{
+  solver->mode = mode;
+}
+
+void solver_set_random (solver_t *solver, const bool random)
+{
+  solver->random = random;
+}
+
+void solver_set_seed (solver_t *solver, const uint64_t seed)
+{
+  solver->seed = seed;
+}
+
+void solver_set_callback (solver_t *solver, solver_callback_t callback,
+                          void *data)
+{
+  solver->callback = callback;
+  solver->data = data;
+}
+
+void solver_set_progress (solver_t *solver, solver_progress_t progress,
+                          const size_t interval, void *data)
+{
+  solver->progress = progress;
+  solver->progress_interval = interval;
+  solver->progress_data = data;
+}
+
+void solver_set_cache (solver_t *solver, cache_t *cache)
+{
+  solver->cache = cache;
+}
+
+void solver_set_store (solver_t *solver, store_t *store)
+{
+  solver->store = store;
+}
+
+void solver_set_memory_limit (solver_t *solver, const size_t bytes)
+{
+  solver->memory_limit = bytes;
+}
+
+void solver_set_timeout (solver_t *solver, const size_t milliseconds)
+{
+  solver->timeout = milliseconds;
+}
+
+void solver_set_max_nodes (solver_t *solver, const size_t nodes)
+{
+  solver->max_nodes = nodes;
+}
+
+void solver_set_cancel (solver_t *solver, atomic_bool *cancel)
+{
+  solver->cancel = cancel;
+}
+
+void solver_set_restarts (solver_t *solver, const bool restarts)
+{
+  solver->restarts = restarts;
+}
+
+void solver_set_portfolio (solver_t *solver, const size_t threads)
+{
+  solver->portfolio = (threads > 0) ? threads : 1;
+  if (solver->portfolio > SOLVER_MAX_PORTFOLIO)
+    solver->portfolio = SOLVER_MAX_PORTFOLIO;
+}
+
+void solver_set_search_fill (solver_t *solver, const bool search)
+{
+  solver->search_fill = search;
+}
+
+size_t solver_get_solutions (const solver_t *solver)
+{
+  return solver->solutions;
+}
+
+size_t solver_get_nodes (const solver_t *solver)
+{
+  return solver->nodes;
+}
+
+const grid_t *solver_get_solution (const solver_t *solver)
+{
+  return solver->solution;
+}
+
+static uint64_t clock_milliseconds (void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/* Start the budgets of a grid, shared by all the searches it needs */
+static void solver_budget (solver_t *solver)
+{
+  solver->deadline = 0;
+  if (solver->timeout)
+    solver->deadline = clock_milliseconds() + solver->timeout;
+  solver->budget = solver->max_nodes;
+  solver->ticks = 0;
+}
+
+/* Whether a budget is exceeded or the search cancelled, the clock and the
+   flag are only read every SOLVER_CHECK_INTERVAL nodes */
+static bool solver_interrupt (solver_t *solver)
+{
+  if (solver->max_nodes) {
+    if (solver->budget == 0)
+      return true;
+    --solver->budget;
+  }
+  if (solver->restart && --solver->restart == 0)
+    return true;
+  if (++solver->ticks % SOLVER_CHECK_INTERVAL != 0)
+    return false;
+  if (solver->cancel &&
+      atomic_load_explicit(solver->cancel, memory_order_relaxed))
+    return true;
+  if (solver->race &&
+      atomic_load_explicit(solver->race, memory_order_relaxed))
+    return true;
+  return solver->deadline && clock_milliseconds() >= solver->deadline;
+}
+
+/* Count a search node, false if the search must stop there */
+static bool solver_node (void *data)
+{
+  solver_t *solver = data;
+  ++solver->nodes;
+  if (solver_interrupt(solver)) {
+    solver->interrupted = true;
+    return false;
+  }
+  if (solver->progress && solver->progress_interval &&
+      solver->nodes % solver->progress_interval == 0)
+    solver->progress(solver->solutions, solver->nodes,
+                     solver->progress_data);
+  return true;
+}
+
+/* Bytes taken by the search structures of a grid size */
+static size_t solver_footprint (const solver_t *solver, const size_t size,
+                                const size_t trail_capacity)
+{
+  return solver->capacity * (sizeof(frame_t) + grid_choice_sizeof()) +
+         grid_sizeof(size) +
+         trail_capacity * (sizeof(uint16_t) + sizeof(colors_t));
+}
+
+/* Save the unsolved cells of the working grid on top of the trail, before
+   changing it. Only the cells that changed are kept by solver_commit(). */
+static bool solver_save (solver_t *solver)
+{
+  size_t size = grid_get_size(solver->work);
+  size_t needed = solver->trail_length + size * size;
+  if (needed > solver->trail_capacity) {
+    size_t capacity = 2 * solver->trail_capacity;
+    if (capacity < needed)
+      capacity = needed;
+    if (solver->memory_limit &&
+        solver_footprint(solver, size, capacity) > solver->memory_limit) {
+      capacity = needed;
+      if (solver_footprint(solver, size, capacity) > solver->memory_limit)
+        return false;
+    }
+    uint16_t *cells = realloc(solver->trail_cells, capacity * sizeof(uint16_t));
+    if (!cells)
+      return false;
+    solver->trail_cells = cells;
+    colors_t *colors = realloc(solver->trail_colors,
+                               capacity * sizeof(colors_t));
+    if (!colors)
+      return false;
+    solver->trail_colors = colors;
+    solver->trail_capacity = capacity;
+  }
+  solver->trail_saved = grid_snapshot(solver->work,
+                                      solver->trail_cells + solver->trail_length,
+                                      solver->trail_colors + solver->trail_length);
+  return true;
+}
+
+static void solver_commit (solver_t *solver)
+{
+  solver->trail_length += grid_changes(solver->work,
+                                       solver->trail_cells + solver->trail_length,
+                                       solver->trail_colors + solver->trail_length,
+                                       solver->trail_saved);
+  solver->trail_saved = 0;
+}
+
+/* Undo the changes of the working grid down to a length of the trail */
+static void solver_undo (solver_t *solver, const size_t mark)
+{
+  grid_restore(solver->work, solver->trail_cells + mark,
+               solver->trail_colors + mark, solver->trail_length - mark);
+  solver->trail_length = mark;
+}
+
+/* Load the grid in the working grid as the root of a new search */
+static bool solver_load (solver_t *solver, const grid_t *grid)
+{
+  size_t size = grid_get_size(grid);
+  if (grid_pool_get_size(solver->pool) != size) {
+    grid_pool_free(solver->pool);
+    solver->pool = grid_pool_new(size);
+    if (!solver->pool)
+      return false;
+  }
+
+  /* Every decision fixes at least one cell, so the search is never deeper
+     than the number of cells: the decision stack is allocated once. */
+  size_t depth_max = size * size + 1;
+  if (solver->capacity < depth_max) {
+    frame_t *stack = realloc(solver->stack, depth_max * sizeof(frame_t));
+    if (stack)
+      solver->stack = stack;
+    char *choices = realloc(solver->choices,
+                            depth_max * grid_choice_sizeof());
+    if (choices)
+      solver->choices = choices;
+    if (!stack || !choices)
+      return false;
+    solver->capacity = depth_max;
+  }
+  solver->depth = 0;
+  solver->trail_length = 0;
+  solver->work = grid_pool_copy(solver->pool, grid);
+  if (!solver->work)
+    return false;
+
+  /* 9x9 grids go to the bitboard engine, the working grid only receives
+     its solutions */
+  if (size == 9 && !(solver->memory_limit &&
+                     board_sizeof() + grid_sizeof(size) > solver->memory_limit)) {
+    if (!solver->board)
+      solver->board = board_new();
+    if (!solver->board)
+      return false;
+    solver->boarded = board_load(solver->board, grid);
+  }
+  if (solver->boarded)
+    return true;
+
+  if (!solver_save(solver))
+    return false;
+  solver->stack[solver->depth++] = (frame_t) { 0, NULL };
+  return true;
+}
+
+/* Resume the search up to the next solution, NULL once it is over.
+
+   The search works on a single grid: instead of a copy of the grid per
+   level, the trail keeps the previous colors of the cells changed by each
+   level, and backtracking undoes them. A node is made of the cells saved
+   before its choice is applied, and of those changed by its propagation.
+   The solution is the working grid, valid until the next call. */
+static const grid_t *solver_resume (solver_t *solver, const bool random)
+{
+  uint64_t *seed = random ? &solver->seed : NULL;
+  grid_t *work = solver->work;
+  if (solver->boarded) {
+    if (board_next(solver->board, seed, solver_node, solver) != BOARD_SOLVED)
+      return NULL;
+    board_solution(solver->board, work);
+    return work;
+  }
+
+  while (solver->depth > 0) {
+    frame_t *frame = &solver->stack[solver->depth - 1];
+    if (!frame->choice) {
+      if (!solver_node(solver))
+        return NULL;
+      size_t c = grid_heuristics(work);
+      solver_commit(solver);
+      if (c == NOT_CONSISTENT) {
+        --solver->depth;
+        continue;
+      }
+      if (c == SOLVED) {
+        --solver->depth;
+        return work;
+      }
+    }
+    else {
+      /* Back from the subtree of the current choice. When a single color
+         is left in the cell, the node becomes its last subtree and is
+         propagated again in place. */
+      solver_undo(solver, frame->mark);
+      if (!solver_save(solver)) {
+        solver->out_of_memory = true;
+        return NULL;
+      }
+      bool last = grid_choice_is_last(work, frame->choice);
+      grid_choice_discard(work, frame->choice);
+      frame->choice = NULL;
+      if (last)
+        continue;
+      solver_commit(solver);
+      if (!grid_is_consistent(work)) {
+        --solver->depth;
+        continue;
+      }
+    }
+
+    choice_t *choice = (choice_t *) (solver->choices + (solver->depth - 1) *
+                                     grid_choice_sizeof());
+    grid_choice_into(work, seed, choice);
+    if (grid_choice_is_empty(choice)) {
+      --solver->depth;
+      continue;
+    }
+    frame->choice = choice;
+    frame->mark = solver->trail_length;
+    if (!solver_save(solver)) {
+      solver->out_of_memory = true;
+      return NULL;
+    }
+    grid_choice_apply(work, frame->choice);
+    solver->stack[solver->depth++] = (frame_t) { 0, NULL };
+  }
+  return NULL;
+}
+
+/* Drop what is left of the search, the pool is recycled as a whole */
+static void solver_drop (solver_t *solver)
+{
+  solver->depth = 0;
+  solver->boarded = false;
+  solver->work = NULL;
+  grid_pool_reset(solver->pool);
+}
+
+static solver_status_t solver_search (solver_t *solver, const grid_t *grid,
+                                      const solver_mode_t mode,
+                                      const bool random, const bool notify)
+{
+  if (solver->work)
+    solver_drop(solver);
+  solver->solutions = 0;
+  solver->nodes = 0;
+  solver->out_of_memory = false;
+  solver->stopped = false;
+  solver->interrupted = false;
+  grid_free(solver->solution);
+  solver->solution = NULL;
+  if (!grid)
+    return SOLVER_UNSOLVABLE;
+
+  if (!solver_load(solver, grid))
+    solver->out_of_memory = true;
+
+  const grid_t *leaf;
+  while ((leaf = solver_resume(solver, random))) {
+    solver->solutions++;
+    if (mode == mode_count)
+      continue;
+    if (!solver->solution) {
+      solver->solution = grid_pool_copy(NULL, leaf);
+      if (!solver->solution)
+        solver->out_of_memory = true;
+    }
+    bool resume = true;
+    if (notify && solver->callback)
+      resume = solver->callback(leaf, solver->data);
+    if (!resume)
+      solver->stopped = true;
+    if (!resume || solver->out_of_memory || mode == mode_first ||
+        (mode == mode_unique && solver->solutions > 1))
+      break;
+  }
+  solver_drop(solver);
+
+  if (solver->out_of_memory)
+    return SOLVER_OUT_OF_MEMORY;
+  if (solver->interrupted)
+    return SOLVER_UNKNOWN;
+  if (solver->solutions == 0)
+    return SOLVER_UNSOLVABLE;
+  return SOLVER_SOLVED;
+}
+
+bool solver_start (solver_t *solver, const grid_t *grid)
+{
+  if (solver->work)
+    solver_drop(solver);
+  solver->solutions = 0;
+  solver->nodes = 0;
+  solver->out_of_memory = false;
+  solver->stopped = false;
+  solver->interrupted = false;
+  grid_free(solver->solution);
+  solver->solution = NULL;
+
+  if (!solver_load(solver, grid)) {
+    solver->out_of_memory = true;
+    return false;
+  }
+  return true;
+}
+
+const grid_t *solver_next (solver_t *solver, solver_status_t *status)
+{
+  solver_status_t outcome = SOLVER_UNSOLVABLE;
+  const grid_t *solution = NULL;
+  if (solver->out_of_memory)
+    outcome = SOLVER_OUT_OF_MEMORY;
+  else if (solver->work) {
+    /* Budgets bound each call, an interrupted search resumes where it was
+       cut: the node it stopped at is visited again */
+    solver_budget(solver);
+    solver->interrupted = false;
+    solution = solver_resume(solver, solver->random);
+    if (solution) {
+      solver->solutions++;
+      outcome = SOLVER_SOLVED;
+    }
+    else if (solver->out_of_memory)
+      outcome = SOLVER_OUT_OF_MEMORY;
+    else if (solver->interrupted)
+      outcome = SOLVER_UNKNOWN;
+  }
+  if (status)
+    *status = outcome;
+  return solution;
+}
+
+solver_status_t solver_stop (solver_t *solver)
+{
+  if (solver->work)
+    solver_drop(solver);
+  if (solver->out_of_memory)
+    return SOLVER_OUT_OF_MEMORY;
+  if (solver->interrupted)
+    return SOLVER_UNKNOWN;
+  if (solver->solutions == 0)
+    return SOLVER_UNSOLVABLE;
+  return SOLVER_SOLVED;
+}
+
+/* Term i >= 1 of the Luby sequence: 1 1 2 1 1 2 4 1 1 2 1 1 2 4 8... */
+static size_t luby (size_t i)
+{
+  while (true) {
+    size_t k = 1;
+    while (((size_t) 1 << k) - 1 < i)
+      ++k;
+    if (i == ((size_t) 1 << k) - 1)
+      return (size_t) 1 << (k - 1);
+    i -= ((size_t) 1 << (k - 1)) - 1;
+  }
+}
+
+/* Random search of a first solution, cut and started over after a number
+   of nodes following the Luby sequence. Each run goes on with the PRNG
+   where the previous one left it. */
+static solver_status_t solver_restart (solver_t *solver, const grid_t *grid,
+                                       const bool notify)
+{
+  size_t nodes = 0;
+  solver_status_t status;
+  for (size_t run = 1; ; ++run) {
+    solver->restart = luby(run) * SOLVER_RESTART_UNIT;
+    status = solver_search(solver, grid, mode_first, true, notify);
+    nodes += solver->nodes;
+    /* Only a cut run has its restart budget spent */
+    if (status != SOLVER_UNKNOWN || solver->restart != 0)
+      break;
+  }
+  solver->restart = 0;
+  solver->nodes = nodes;
+  return status;
+}
+
+/* Cells of unit u of a grid of a size: rows, then columns, then boxes */
+static void solver_unit (const size_t size, const size_t u, size_t rows[],
+                         size_t columns[])
+{
+  size_t block = sqrt(size);
+  size_t index = u % size;
+  for (size_t i = 0; i < size; ++i)
+    if (u < size) {
+      rows[i] = index;
+      columns[i] = i;
+    }
+    else if (u < 2 * size) {
+      rows[i] = i;
+      columns[i] = index;
+    }
+    else {
+      rows[i] = index / block * block + i / block;
+      columns[i] = index % block * block + i % block;
+    }
+}
+
+/* Count the solutions up to a relabeling of the k digits that no clue
+   uses: they are interchangeable, so the k! relabelings of a solution are
+   distinct solutions. Only the one where these digits come in increasing
+   order along the unit with the fewest empty cells is counted, with one
+   search for each choice of their cells in that unit. */
+static solver_status_t solver_count (solver_t *solver, const grid_t *grid)
+{
+  size_t size = grid_get_size(grid);
+  colors_t present = colors_empty();
+  for (size_t i = 0; i < size; ++i)
+    for (size_t j = 0; j < size; ++j) {
+      colors_t cell = grid_get_colors(grid, i, j);
+      if (colors_is_singleton(cell))
+        present = colors_or(present, cell);
+    }
+  colors_t absent = colors_subtract(colors_full(size), present);
+  size_t k = colors_count(absent);
+  /* Candidates that tell these digits apart break the symmetry */
+  for (size_t i = 0; i < size; ++i)
+    for (size_t j = 0; j < size; ++j) {
+      colors_t cell = colors_and(grid_get_colors(grid, i, j), absent);
+      if (!colors_is_empty(cell) && !colors_is_equal(cell, absent))
+        k = 0;
+    }
+  size_t orbit = 1;
+  for (size_t i = 2; i <= k; ++i)
+    if (__builtin_mul_overflow(orbit, i, &orbit))
+      k = 0;
+  if (k < 2)
+    return solver_search(solver, grid, mode_count, false, true);
+
+  solver->out_of_memory = false;
+  solver->stopped = false;
+  solver->interrupted = false;
+  grid_free(solver->solution);
+  solver->solution = NULL;
+
+  size_t rows[size];
+  size_t columns[size];
+  size_t empty = size + 1;
+  size_t best = 0;
+  for (size_t u = 0; u < 3 * size; ++u) {
+    solver_unit(size, u, rows, columns);
+    size_t count = 0;
+    for (size_t i = 0; i < size; ++i)
+      if (!colors_is_singleton(grid_get_colors(grid, rows[i], columns[i])))
+        ++count;
+    if (count < empty) {
+      empty = count;
+      best = u;
+    }
+  }
+  solver_unit(size, best, rows, columns);
+  size_t cells[size];
+  size_t m = 0;
+  for (size_t i = 0; i < size; ++i)
+    if (!colors_is_singleton(grid_get_colors(grid, rows[i], columns[i])))
+      cells[m++] = i;
+  size_t digits[k];
+  colors_t left = absent;
+  for (size_t d = 0; d < k; ++d) {
+    digits[d] = colors_index(left);
+    left = colors_discard(left, digits[d]);
+  }
+
+  /* Subsets of k of the m empty cells of the unit, in lexicographic order */
+  size_t chosen[k];
+  for (size_t d = 0; d < k; ++d)
+    chosen[d] = d;
+  size_t solutions = 0;
+  size_t nodes = 0;
+  solver_status_t status = SOLVER_UNSOLVABLE;
+  while (m >= k) {
+    grid_t *copy = grid_pool_copy(NULL, grid);
+    if (!copy) {
+      status = SOLVER_OUT_OF_MEMORY;
+      break;
+    }
+    bool valid = true;
+    for (size_t i = 0, d = 0; i < m && valid; ++i) {
+      size_t row = rows[cells[i]];
+      size_t column = columns[cells[i]];
+      colors_t colors = grid_get_colors(copy, row, column);
+      if (d < k && chosen[d] == i)
+        colors = colors_and(colors, colors_set(digits[d++]));
+      else
+        colors = colors_subtract(colors, absent);
+      valid = !colors_is_empty(colors);
+      grid_set_colors(copy, row, column, colors);
+    }
+    if (valid) {
+      status = solver_search(solver, copy, mode_count, false, true);
+      nodes += solver->nodes;
+      solutions += solver->solutions;
+    }
+    grid_free(copy);
+    if (status == SOLVER_OUT_OF_MEMORY || status == SOLVER_UNKNOWN)
+      break;
+
+    size_t d = k;
+    while (d > 0 && chosen[d - 1] == m - k + d - 1)
+      --d;
+    if (d == 0)
+      break;
+    ++chosen[d - 1];
+    for (size_t e = d; e < k; ++e)
+      chosen[e] = chosen[e - 1] + 1;
+  }
+
+  solver->nodes = nodes;
+  if (status == SOLVER_OUT_OF_MEMORY || status == SOLVER_UNKNOWN)
+    return status;
+  if (__builtin_mul_overflow(solutions, orbit, &solver->solutions) ||
+      solver->solutions == CACHE_UNKNOWN) {
+    /* Too many solutions to be counted */
+    solver->solutions = CACHE_UNKNOWN;
+    solver->interrupted = true;
+    return SOLVER_UNKNOWN;
+  }
+  return (solver->solutions > 0) ? SOLVER_SOLVED : SOLVER_UNSOLVABLE;
+}
+
+/* Search of one worker of a portfolio, the first one to settle the grid
+   (a solution, or a proof that there is none) cancels the others */
+typedef struct
+{
+  solver_t *solver;
+  const grid_t *grid;
+  solver_status_t status;
+  atomic_bool *race;
+  pthread_mutex_t *lock;
+  solver_t **winner;
+} racer_t;
+
+static void *solver_worker (void *data)
+{
+  racer_t *entry = data;
+  solver_t *solver = entry->solver;
+  if (solver->restarts && solver->random)
+    entry->status = solver_restart(solver, entry->grid, false);
+  else
+    entry->status = solver_search(solver, entry->grid, mode_first,
+                                  solver->random, false);
+  if (entry->status == SOLVER_SOLVED || entry->status == SOLVER_UNSOLVABLE) {
+    pthread_mutex_lock(entry->lock);
+    if (!*entry->winner) {
+      *entry->winner = solver;
+      atomic_store(entry->race, true);
+    }
+    pthread_mutex_unlock(entry->lock);
+  }
+  return NULL;
+}
+
+/* Race the context configuration against randomly seeded copies of it, on
+   as many threads as the portfolio asks */
+static solver_status_t solver_race (solver_t *solver, const grid_t *grid)
+{
+  size_t threads = solver->portfolio;
+  if (solver->workers_count < threads) {
+    solver_t **workers = realloc(solver->workers, threads * sizeof(solver_t *));
+    if (!workers)
+      return solver_search(solver, grid, mode_first, solver->random, true);
+    solver->workers = workers;
+    while (solver->workers_count < threads) {
+      solver->workers[solver->workers_count] = solver_new();
+      if (!solver->workers[solver->workers_count])
+        return solver_search(solver, grid, mode_first, solver->random, true);
+      ++solver->workers_count;
+    }
+  }
+
+  atomic_bool race = false;
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  solver_t *winner = NULL;
+  racer_t entries[threads];
+  pthread_t ids[threads];
+  bool started[threads];
+  for (size_t i = 0; i < threads; ++i) {
+    solver_t *worker = solver->workers[i];
+    worker->random = (i == 0) ? solver->random : true;
+    worker->seed = random_next(&solver->seed);
+    worker->memory_limit = solver->memory_limit;
+    worker->max_nodes = solver->max_nodes;
+    worker->cancel = solver->cancel;
+    worker->restarts = solver->restarts;
+    worker->deadline = solver->deadline;
+    worker->budget = solver->budget;
+    worker->race = &race;
+    entries[i] = (racer_t) { worker, grid, SOLVER_UNKNOWN, &race, &lock,
+                             &winner };
+    started[i] = pthread_create(&ids[i], NULL, solver_worker,
+                                &entries[i]) == 0;
+  }
+
+  size_t nodes = 0;
+  bool out_of_memory = false;
+  for (size_t i = 0; i < threads; ++i) {
+    if (!started[i])
+      continue;
+    pthread_join(ids[i], NULL);
+    nodes += solver->workers[i]->nodes;
+    if (entries[i].status == SOLVER_OUT_OF_MEMORY)
+      out_of_memory = true;
+  }
+  pthread_mutex_destroy(&lock);
+  /* The flag dies with this frame */
+  for (size_t i = 0; i < threads; ++i)
+    solver->workers[i]->race = NULL;
+
+  solver->solutions = 0;
+  solver->nodes = nodes;
+  solver->out_of_memory = false;
+  solver->stopped = false;
+  solver->interrupted = false;
+  grid_free(solver->solution);
+  solver->solution = NULL;
+  if (!winner) {
+    if (out_of_memory) {
+      solver->out_of_memory = true;
+      return SOLVER_OUT_OF_MEMORY;
+    }
+    solver->interrupted = true;
+    return SOLVER_UNKNOWN;
+  }
+  if (winner->solutions == 0)
+    return SOLVER_UNSOLVABLE;
+
+  solver->solutions = 1;
+  solver->solution = winner->solution;
+  winner->solution = NULL;
+  if (solver->callback && !solver->callback(solver->solution, solver->data))
+    solver->stopped = true;
+  return SOLVER_SOLVED;
+}
+
+/* Search a grid with the strategy configured for its mode */
+static solver_status_t solver_run (solver_t *solver, const grid_t *grid)
+{
+  if (grid && solver->mode == mode_count)
+    return solver_count(solver, grid);
+  if (grid && solver->mode == mode_first) {
+    if (solver->portfolio > 1)
+      return solver_race(solver, grid);
+    if (solver->restarts && solver->random)
+      return solver_restart(solver, grid, true);
+  }
+  return solver_search(solver, grid, solver->mode, solver->random, true);
+}
+
+/* Open cell of a propagated grid with the fewest candidates */
+static void solver_branch (const grid_t *grid, size_t *row, size_t *column)
+{
+  size_t size = grid_get_size(grid);
+  size_t best = SIZE_MAX;
+  for (size_t i = 0; i < size; ++i)
+    for (size_t j = 0; j < size; ++j) {
+      size_t count = colors_count(grid_get_colors(grid, i, j));
+      if (count > 1 && count < best) {
+        best = count;
+        *row = i;
+        *column = j;
+      }
+    }
+}
+
+/* Split the subtree of work, whose decisions are the clues of clues */
+static bool solver_split_r (solver_t *solver, grid_t *clues, grid_t *work,
+                            const size_t depth, solver_callback_t unit,
+                            void *data)
+{
+  if (!solver_node(solver))
+    return false;
+  size_t c = grid_heuristics(work);
+  if (c == NOT_CONSISTENT)
+    return true;
+  if (c == SOLVED || depth == 0) {
+    ++solver->solutions;
+    return unit(clues, data);
+  }
+
+  size_t row = 0;
+  size_t column = 0;
+  solver_branch(work, &row, &column);
+  colors_t candidates = grid_get_colors(work, row, column);
+  bool resume = true;
+  while (resume && !colors_is_empty(candidates)) {
+    colors_t color = colors_rightmost(candidates);
+    candidates = colors_subtract(candidates, color);
+    grid_t *child_clues = grid_pool_copy(NULL, clues);
+    grid_t *child_work = grid_pool_copy(NULL, work);
+    if (!child_clues || !child_work) {
+      grid_free(child_clues);
+      grid_free(child_work);
+      solver->out_of_memory = true;
+      return false;
+    }
+    grid_set_colors(child_clues, row, column, color);
+    grid_set_colors(child_work, row, column, color);
+    resume = solver_split_r(solver, child_clues, child_work, depth - 1, unit,
+                            data);
+    grid_free(child_clues);
+    grid_free(child_work);
+  }
+  return resume;
+}
+
+solver_status_t solver_split (solver_t *solver, const grid_t *grid,
+                              const size_t depth, solver_callback_t unit,
+                              void *data)
+{
+  solver_budget(solver);
+  solver->solutions = 0;
+  solver->nodes = 0;
+  solver->out_of_memory = false;
+  solver->stopped = false;
+  solver->interrupted = false;
+  grid_free(solver->solution);
+  solver->solution = NULL;
+  if (!grid)
+    return SOLVER_UNSOLVABLE;
+
+  grid_t *clues = grid_pool_copy(NULL, grid);
+  grid_t *work = grid_pool_copy(NULL, grid);
+  if (clues && work && !solver_split_r(solver, clues, work, depth, unit, data))
+    solver->stopped = !solver->out_of_memory && !solver->interrupted;
+  if (!clues || !work)
+    solver->out_of_memory = true;
+  grid_free(clues);
+  grid_free(work);
+
+  if (solver->out_of_memory)
+    return SOLVER_OUT_OF_MEMORY;
+  if (solver->interrupted)
+    return SOLVER_UNKNOWN;
+  return (solver->solutions > 0) ? SOLVER_SOLVED : SOLVER_UNSOLVABLE;
+}
+
+/* Run a probe from the root of the search of grid down to a leaf, taking
+   a random candidate of the cell of fewest candidates at each node, and
+   give its weight in log10: the product of the branching factors on the
+   way, -INFINITY if it ends in a contradiction. False if interrupted. */
+static bool solver_probe (solver_t *solver, const grid_t *grid,
+                          double *weight)
+{
+  grid_pool_reset(solver->pool);
+  grid_t *work = grid_pool_copy(solver->pool, grid);
+  if (!work) {
+    solver->out_of_memory = true;
+    return false;
+  }
+
+  *weight = 0;
+  while (true) {
+    if (!solver_node(solver))
+      return false;
+    size_t c = grid_heuristics(work);
+    if (c == NOT_CONSISTENT) {
+      *weight = -INFINITY;
+      return true;
+    }
+    if (c == SOLVED)
+      return true;
+
+    size_t row = 0;
+    size_t column = 0;
+    solver_branch(work, &row, &column);
+    colors_t candidates = grid_get_colors(work, row, column);
+    *weight += log10(colors_count(candidates));
+    grid_set_colors(work, row, column,
+                    colors_random_r(candidates, &solver->seed));
+  }
+}
+
+solver_status_t solver_estimate (solver_t *solver, const grid_t *grid,
+                                 const size_t probes,
+                                 solver_estimate_t *estimate)
+{
+  if (solver->work)
+    solver_drop(solver);
+  solver->solutions = 0;
+  solver->nodes = 0;
+  solver->out_of_memory = false;
+  solver->stopped = false;
+  solver->interrupted = false;
+  grid_free(solver->solution);
+  solver->solution = NULL;
+  *estimate = (solver_estimate_t) { 0, 0, -INFINITY, -INFINITY, -INFINITY };
+  if (!grid)
+    return SOLVER_UNSOLVABLE;
+  if (!probes && !solver->timeout && !solver->max_nodes && !solver->cancel)
+    return SOLVER_UNKNOWN;
+
+  size_t size = grid_get_size(grid);
+  if (grid_pool_get_size(solver->pool) != size) {
+    grid_pool_free(solver->pool);
+    solver->pool = grid_pool_new(size);
+    if (!solver->pool)
+      return SOLVER_OUT_OF_MEMORY;
+  }
+
+  /* The weights are summed relative to the largest one so far, scale in
+     log10, which keeps the sums in range whatever the size of the grid */
+  solver_budget(solver);
+  double scale = -INFINITY;
+  double sum = 0;
+  double squares = 0;
+  while (!probes || estimate->probes < probes) {
+    double weight;
+    if (!solver_probe(solver, grid, &weight))
+      break;
+    ++estimate->probes;
+    if (weight == -INFINITY)
+      continue;
+    ++estimate->hits;
+    if (weight > scale) {
+      double factor = (scale == -INFINITY) ? 0 : pow(10, scale - weight);
+      sum *= factor;
+      squares *= factor * factor;
+      scale = weight;
+    }
+    double w = pow(10, weight - scale);
+    sum += w;
+    squares += w * w;
+  }
+  grid_pool_reset(solver->pool);
+  solver->solutions = estimate->probes;
+
+  if (solver->out_of_memory)
+    return SOLVER_OUT_OF_MEMORY;
+  if (estimate->hits == 0)
+    return SOLVER_UNKNOWN;
+
+  /* 95% interval of the mean of the weights, which is at least 1 since a
+     probe reached a solution */
+  double n = estimate->probes;
+  double mean = sum / n;
+  double variance = INFINITY;
+  if (n > 1)
+    variance = fmax(0, (squares - n * mean * mean) / (n - 1));
+  double half = 1.96 * sqrt(variance / n);
+  estimate->log10_count = scale + log10(mean);
+  estimate->log10_low = (mean > half) ? fmax(0, scale + log10(mean - half)) : 0;
+  estimate->log10_high = scale + log10(mean + half);
+  return SOLVER_SOLVED;
+}
+
+/* Whether a known result is enough to answer in the mode */
+static bool solver_known (const solver_mode_t mode, const size_t count,
+                          const grid_t *solution)
+{
+  if (count == 0)
+    return true;
+  if (mode == mode_count)
+    return count != CACHE_UNKNOWN;
+  return solution && (mode == mode_first || count == 1);
+}
+
+/* Merge what the cache and the store know about the grid, the results
+   found in the store are promoted to the cache */
+static void solver_lookup (solver_t *solver, const canon_t *canon,
+                           size_t *count, grid_t **solution)
+{
+  *count = CACHE_UNKNOWN;
+  *solution = NULL;
+  if (solver->cache)
+    cache_get(solver->cache, canon, count, solution);
+  if (!solver->store || solver_known(solver->mode, *count, *solution))
+    return;
+
+  size_t stored;
+  grid_t *copy;
+  if (!store_get(solver->store, canon, &stored, &copy))
+    return;
+  if (*count == CACHE_UNKNOWN)
+    *count = stored;
+  if (!*solution) {
+    *solution = copy;
+    copy = NULL;
+  }
+  grid_free(copy);
+  if (solver->cache)
+    cache_put(solver->cache, canon, *count, *solution);
+}
+
+/* Answer from the known results when they are enough for the mode */
+static bool solver_cached (solver_t *solver, const canon_t *canon,
+                           solver_status_t *status)
+{
+  size_t count;
+  grid_t *solution;
+  solver_lookup(solver, canon, &count, &solution);
+  if (!solver_known(solver->mode, count, solution)) {
+    grid_free(solution);
+    return false;
+  }
+
+  solver->solutions = 0;
+  solver->nodes = 0;
+  solver->out_of_memory = false;
+  solver->stopped = false;
+  grid_free(solver->solution);
+  solver->solution = NULL;
+  if (solver->mode == mode_count)
+    solver->solutions = count;
+  else if (count != 0) {
+    solver->solutions = 1;
+    solver->solution = solution;
+    solution = NULL;
+    if (solver->callback)
+      solver->callback(solver->solution, solver->data);
+  }
+  grid_free(solution);
+
+  *status = (solver->solutions == 0) ? SOLVER_UNSOLVABLE : SOLVER_SOLVED;
+  return true;
+}
+
+/* Whether the results of a grid can be shared through its canonical form,
+   which only holds the singletons: every other cell must be empty */
+static bool solver_shareable (const grid_t *grid)
+{
+  size_t size = grid_get_size(grid);
+  colors_t full = colors_full(size);
+  for (size_t row = 0; row < size; ++row)
+    for (size_t column = 0; column < size; ++column) {
+      colors_t colors = grid_get_colors(grid, row, column);
+      if (!colors_is_singleton(colors) && !colors_is_equal(colors, full))
+        return false;
+    }
+  return true;
+}
+
+solver_status_t solver_solve (solver_t *solver, const grid_t *grid)
+{
+  solver_budget(solver);
+  canon_t *canon = NULL;
+  if ((solver->cache || solver->store) && grid && solver_shareable(grid))
+    canon = canon_new(grid);
+  if (!canon)
+    return solver_run(solver, grid);
+
+  solver_status_t status;
+  if (solver_cached(solver, canon, &status)) {
+    canon_free(canon);
+    return status;
+  }
+  status = solver_run(solver, grid);
+  if (status != SOLVER_OUT_OF_MEMORY && status != SOLVER_UNKNOWN &&
+      !solver->stopped) {
+    /* Only complete enumerations know the number of solutions */
+    size_t count = solver->solutions;
+    if (solver->mode == mode_first && count > 0)
+      count = CACHE_UNKNOWN;
+    if (solver->mode == mode_unique && count > 1)
+      count = CACHE_UNKNOWN;
+    if (solver->cache)
+      cache_put(solver->cache, canon, count, solver->solution);
+    if (solver->store)
+      store_put(solver->store, canon, count, solver->solution);
+  }
+  canon_free(canon);
+  return status;
+}
+
+/* Solved grid to carve a puzzle from */
+static grid_t *solver_fill (solver_t *solver, const size_t size)
+{
+  TRACE_SPAN("generator_fill");
+  grid_t *grid = grid_alloc(size);
+  if (!grid)
+    return NULL;
+
+  if (solver->search_fill) {
+    grid_initialize_r(grid, &solver->seed);
+    solver_status_t status = solver_search(solver, grid, mode_first, true,
+                                           false);
+    grid_free(grid);
+    if (status != SOLVER_SOLVED)
+      return NULL;
+    grid = grid_pool_copy(NULL, solver->solution);
+  }
+  else
+    grid_fill_r(grid, &solver->seed);
+  return grid;
+}
+
+/* Empty cells of a solved grid in random order, while it keeps a single
+   solution if unique is set. SOLVER_UNKNOWN or SOLVER_OUT_OF_MEMORY when
+   the budget or the memory runs out first, the cells emptied so far are
+   kept. */
+static solver_status_t solver_carve (solver_t *solver, grid_t *grid,
+                                     const bool unique)
+{
+  TRACE_SPAN("generator_carve");
+  size_t size = grid_get_size(grid);
+  size_t total = size * size;
+  size_t *pos = malloc(total * sizeof(size_t));
+  if (!pos)
+    return SOLVER_OUT_OF_MEMORY;
+  for (size_t i = 0; i < total; i ++)
+    pos[i] = i;
+  for (size_t i = total - 1; i > 0; --i) {
+    size_t j = random_next(&solver->seed) % i;
+    size_t temp = pos[i];
+    pos[i] = pos[j];
+    pos[j] = temp;
+  }
+  size_t count = total * EMPTY_RATE;
+  solver_status_t result = SOLVER_SOLVED;
+  if (!unique)
+    for (size_t i = 0; i < count; ++i)
+      grid_set_cell(grid, pos[i] / size, pos[i] % size, EMPTY_CELL);
+  else {
+    for (size_t i = 0; i < total && count > 0; ++i) {
+      grid_t *copy = grid_copy(grid);
+      if (!copy) {
+        result = SOLVER_OUT_OF_MEMORY;
+        break;
+      }
+      grid_set_cell(copy, pos[i] / size, pos[i] % size, EMPTY_CELL);
+      solver_status_t status = solver_search(solver, copy, mode_unique, false,
+                                             false);
+      grid_free(copy);
+      if (status == SOLVER_UNKNOWN || status == SOLVER_OUT_OF_MEMORY) {
+        result = status;
+        break;
+      }
+      /* Only a complete search proves the solution is still unique */
+      if (status == SOLVER_SOLVED && solver->solutions == 1) {
+        grid_set_cell(grid, pos[i] / size, pos[i] % size, EMPTY_CELL);
+        --count;
+      }
+    }
+  }
+  free(pos);
+  return result;
+}
+
+grid_t *solver_generate (solver_t *solver, const size_t size,
+                         const bool unique, solver_status_t *status)
+{
+  solver_budget(solver);
+  solver_status_t result = SOLVER_SOLVED;
+  grid_t *grid = solver_fill(solver, size);
+  if (!grid)
+    result = solver->interrupted ? SOLVER_UNKNOWN : SOLVER_OUT_OF_MEMORY;
+  else
+    result = solver_carve(solver, grid, unique);
+  if (status)
+    *status = result;
+  return grid;
+}
@@ -0,0 +1,239 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "store.h"
+
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STORE_MAGIC "SUDOKUST"
+#define STORE_VERSION 1
+
+/* Bytes before the first slot */
+#define STORE_HEADER 64
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t size;
+  uint64_t slots;
+  uint64_t slot_size;
+} header_t;
+
+/* The sequence of a slot is 0 while it is empty, odd while it is written
+   and even once published. The key never changes once published, the
+   count and the solution are read optimistically and read again if the
+   sequence moved meanwhile. */
+typedef struct
+{
+  _Atomic uint64_t sequence;
+  uint64_t hash;
+  uint64_t count;
+  unsigned char data[];
+} slot_t;
+
+struct store_t
+{
+  size_t size;
+  size_t slots;
+  size_t slot_size;
+  size_t length;
+  unsigned char *map;
+};
+
+static slot_t *store_slot (const store_t *store, const size_t index)
+{
+  return (slot_t *) (store->map + STORE_HEADER + index * store->slot_size);
+}
+
+/* Lock the whole file while the header is created or checked */
+static bool store_lock (const int fd, const short type)
+{
+  struct flock lock;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  while (fcntl(fd, F_SETLKW, &lock) < 0)
+    if (errno != EINTR)
+      return false;
+  return true;
+}
+
+store_t *store_open (const char *path, const size_t size)
+{
+  _Atomic uint64_t sequence;
+  if (!atomic_is_lock_free(&sequence))
+    return NULL;
+
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return NULL;
+  if (!store_lock(fd, F_WRLCK)) {
+    close(fd);
+    return NULL;
+  }
+
+  header_t header;
+  struct stat status;
+  bool valid = fstat(fd, &status) == 0;
+  if (valid && status.st_size == 0) {
+    /* New store, sized for the given grids */
+    valid = grid_check_size(size);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+    header.version = STORE_VERSION;
+    header.size = size;
+    header.slot_size = (sizeof(slot_t) + 2 * size * size + 7) / 8 * 8;
+    header.slots = STORE_MAX_BYTES / header.slot_size;
+    if (header.slots > STORE_MAX_SLOTS)
+      header.slots = STORE_MAX_SLOTS;
+    if (valid)
+      valid = ftruncate(fd, STORE_HEADER + header.slots * header.slot_size) == 0 &&
+              pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+  }
+  else if (valid) {
+    valid = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+            !memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)) &&
+            header.version == STORE_VERSION &&
+            grid_check_size(header.size) && header.slots > 0 &&
+            header.slot_size >= sizeof(slot_t) + 2 * header.size * header.size &&
+            (uint64_t) status.st_size >= STORE_HEADER + header.slots * header.slot_size;
+  }
+  store_lock(fd, F_UNLCK);
+
+  store_t *store = valid ? malloc(sizeof(store_t)) : NULL;
+  if (!store) {
+    close(fd);
+    return NULL;
+  }
+  store->size = header.size;
+  store->slots = header.slots;
+  store->slot_size = header.slot_size;
+  store->length = STORE_HEADER + header.slots * header.slot_size;
+  store->map = mmap(NULL, store->length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+  close(fd);
+  if (store->map == MAP_FAILED) {
+    free(store);
+    return NULL;
+  }
+  return store;
+}
+
+void store_close (store_t *store)
+{
+  if (!store)
+    return;
+
+  munmap(store->map, store->length);
+  free(store);
+}
+
+size_t store_get_size (const store_t *store)
+{
+  return store->size;
+}
+
+/* Sequence of a slot once its writer is done, still odd if the writer is
+   at it after STORE_SPINS tries: it may have died during the update */
+static uint64_t slot_settle (slot_t *slot)
+{
+  uint64_t sequence = atomic_load_explicit(&slot->sequence,
+                                           memory_order_acquire);
+  for (size_t spin = 0; (sequence & 1) && spin < STORE_SPINS; ++spin) {
+    sched_yield();
+    sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+  }
+  return sequence;
+}
+
+bool store_get (store_t *store, const canon_t *canon, size_t *count,
+                grid_t **solution)
+{
+  size_t cells = store->size * store->size;
+  if (canon_get_size(canon) != store->size)
+    return false;
+
+  uint64_t hash = canon_hash(canon);
+  const unsigned char *key = canon_get_key(canon);
+  unsigned char copy[cells];
+  for (size_t probe = 0; probe < STORE_PROBES; ++probe) {
+    slot_t *slot = store_slot(store, (hash + probe) % store->slots);
+    uint64_t sequence = slot_settle(slot);
+    if (sequence == 0)
+      return false;
+    if (sequence & 1 || slot->hash != hash || memcmp(slot->data, key, cells))
+      continue;
+
+    uint64_t result = slot->count;
+    memcpy(copy, slot->data + cells, cells);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != sequence) {
+      /* Updated while read, read it again */
+      --probe;
+      continue;
+    }
+
+    *count = result;
+    *solution = (copy[0] != 0) ? canon_decode(canon, copy) : NULL;
+    return true;
+  }
+  return false;
+}
+
+void store_put (store_t *store, const canon_t *canon, const size_t count,
+                const grid_t *solution)
+{
+  size_t cells = store->size * store->size;
+  if (canon_get_size(canon) != store->size)
+    return;
+
+  uint64_t hash = canon_hash(canon);
+  const unsigned char *key = canon_get_key(canon);
+  unsigned char encoded[cells];
+  if (solution)
+    canon_encode(canon, solution, encoded);
+
+  for (size_t probe = 0; probe < STORE_PROBES; ++probe) {
+    slot_t *slot = store_slot(store, (hash + probe) % store->slots);
+    uint64_t sequence = slot_settle(slot);
+    if (sequence == 0) {
+      if (!atomic_compare_exchange_strong(&slot->sequence, &sequence, 1)) {
+        /* Claimed by someone else meanwhile, look at it again */
+        --probe;
+        continue;
+      }
+      slot->hash = hash;
+      slot->count = count;
+      memcpy(slot->data, key, cells);
+      if (solution)
+        memcpy(slot->data + cells, encoded, cells);
+      else
+        memset(slot->data + cells, 0, cells);
+      atomic_store_explicit(&slot->sequence, 2, memory_order_release);
+      return;
+    }
+    if (sequence & 1 || slot->hash != hash || memcmp(slot->data, key, cells))
+      continue;
+
+    /* Merge into the published result, unless someone else is at it */
+    if (!atomic_compare_exchange_strong(&slot->sequence, &sequence,
+                                        sequence + 1))
+      return;
+    if (count != CACHE_UNKNOWN)
+      slot->count = count;
+    if (solution && slot->data[cells] == 0)
+      memcpy(slot->data + cells, encoded, cells);
+    atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+    return;
+  }
+}
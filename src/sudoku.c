@@ -1,287 +1,694 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "sudoku.h"
 
+#include "server.h"
+
+#include "board.h"
 #include "grid.h"
+#include "solver.h"
+#include "trace.h"
 
+#include <limits.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include <err.h>
+#include <errno.h>
 #include <getopt.h>
 #include <string.h>
 #include <time.h>
 
-typedef enum { mode_first, mode_all, mode_unique } mode_t;
+/* Search nodes between two progress reports */
+#define PROGRESS_INTERVAL (1 << 20)
+
+/* Time budget of an estimate in milliseconds, when none is given */
+#define ESTIMATE_TIMEOUT 1000
+
+/* Most threads of any kind an option can ask for */
+#define MAX_THREADS 1024
+
 static bool verbose = false;
-static size_t solutions = 0;
 
-static grid_t *file_parser (char *filename)
+/* Parse a decimal number up to max, false unless the whole string is one */
+static bool number_parser (const char *str, const size_t max, size_t *number)
+{
+  if (*str < '0' || *str > '9')
+    return false;
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(str, &end, 10);
+  if (*end != '\0' || errno == ERANGE || value > max)
+    return false;
+
+  *number = value;
+  return true;
+}
+
+/* Parse a size in bytes with an optional K, M or G suffix, false unless
+   the whole string is a decimal number that fits */
+static bool size_parser (const char *str, size_t *bytes)
+{
+  if (*str < '0' || *str > '9')
+    return false;
+  char *end;
+  errno = 0;
+  unsigned long long value = strtoull(str, &end, 10);
+  if (errno == ERANGE)
+    return false;
+
+  unsigned shift = 0;
+  switch (*end) {
+    case 'G':
+    case 'g':
+      shift = 30;
+      ++end;
+      break;
+    case 'M':
+    case 'm':
+      shift = 20;
+      ++end;
+      break;
+    case 'K':
+    case 'k':
+      shift = 10;
+      ++end;
+      break;
+  }
+  if (*end != '\0' || value > (ULLONG_MAX >> shift) ||
+      (value << shift) > SIZE_MAX)
+    return false;
+
+  *bytes = value << shift;
+  return true;
+}
+
+static grid_t *file_reader (const char *filename, char *error,
+                            const size_t error_size)
 { 
+  TRACE_SPAN("file_parser");
   FILE *stream = fopen(filename, "r");
   if (stream == NULL)
     errx(EXIT_FAILURE, "Can't open input file!");
 
-  char first_row[MAX_GRID_SIZE];
-  int ch;
-  size_t n = 0;
-  size_t line = 1;
-  bool comment = false;
-  bool exit = false;
-  while(!exit) {
-    ch = fgetc(stream);
-    
-    if (ch == EOF) {
-      line++;
+  size_t length = 0;
+  size_t capacity = 4096;
+  char *buffer = malloc(capacity);
+  while (buffer) {
+    length += fread(buffer + length, 1, capacity - length, stream);
+    if (length < capacity)
       break;
-    }
-    
-    if (ch == '\n') {
-      line++;
-      if (n > 0)
-        break;
-      comment = false;
-      continue;
-    }
-    
-    if (!comment) {
-      switch (ch) {
-        case ' ':
-        case '\t':
-          break;
-
-        case '\n':
-          line++;
-          if (n > 0)
-            exit = true;
-          break;
-
-        case '#':
-          comment = true;
-          break;
-
-        default:
-          if (n == MAX_GRID_SIZE) {
-            warnx("error: line %zu is malformed! (exceed max size)", line);
-            fclose(stream);
-            return NULL;
-          }
-          first_row[n++] = ch;
-          break;
-      }
-    }
+    capacity *= 2;
+    char *larger = realloc(buffer, capacity);
+    if (!larger)
+      free(buffer);
+    buffer = larger;
   }
-  
-  if (n == 0) {
-    warnx("error: Grid is empty");
-    fclose(stream);
+  fclose(stream);
+  if (!buffer) {
+    snprintf(error, error_size, "Can't allocate new grid!");
     return NULL;
   }
-  
-  grid_t *grid = grid_alloc(n);
-  if (!grid) {
-    warnx("error: Can't allocate new grid!");
-    fclose(stream);
-    return NULL;
+
+  grid_t *grid = grid_parse(buffer, length, error, error_size);
+  free(buffer);
+  return grid;
+}
+
+static grid_t *file_parser (char *filename)
+{
+  char error[128];
+  grid_t *grid = file_reader(filename, error, sizeof(error));
+  if (!grid)
+    warnx("error: %s", error);
+  return grid;
+}
+
+/* Solution callback writing each solution in the output stream */
+static bool solution_printer (const grid_t *solution, void *data)
+{
+  grid_print(solution, data);
+  return true;
+}
+
+/* Work units of a grid, written in files named after its file */
+typedef struct
+{
+  const char *input;
+  size_t count;
+  bool failed;
+} splitter_t;
+
+/* Work unit callback writing each unit in its own file */
+static bool unit_writer (const grid_t *unit, void *data)
+{
+  splitter_t *splitter = data;
+  char path[strlen(splitter->input) + 32];
+  snprintf(path, sizeof(path), "%s.unit%zu", splitter->input,
+           ++splitter->count);
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    warnx("error: can't write the work unit %s!", path);
+    splitter->failed = true;
+    return false;
   }
+  grid_print(unit, file);
+  fclose(file);
+  return true;
+}
 
-  for (size_t i = 0; i < n; i++)
-    if (grid_check_char(grid, first_row[i]))
-      grid_set_cell(grid, 0, i, first_row[i]);
-    else {
-      warnx("error: wrong character '%c' at line %zu!", first_row[i], line - 1);
-      grid_free(grid);
-      fclose(stream);
-      return NULL;
+/* Once the split is complete, rename FILE.unitI to FILE.unitI-of-N so that
+   the merge can tell when a unit is missing or given twice */
+static bool unit_namer (const splitter_t *splitter)
+{
+  bool all_good = true;
+  size_t length = strlen(splitter->input) + 64;
+  for (size_t i = 1; i <= splitter->count; ++i) {
+    char path[length];
+    char name[length];
+    snprintf(path, sizeof(path), "%s.unit%zu", splitter->input, i);
+    snprintf(name, sizeof(name), "%s.unit%zu-of-%zu", splitter->input, i,
+             splitter->count);
+    if (rename(path, name)) {
+      warnx("error: can't rename the work unit %s!", path);
+      all_good = false;
     }
-  size_t row = 1;
-  
-  n = 0;
-  comment = false;
-  while(true) {
-    ch = fgetc(stream);
-    
-    if (ch == '\n' || ch == EOF) {
-      comment = false;
-      if (n == grid_get_size(grid)) {
-        row++;
-        n = 0;
+  }
+  return all_good;
+}
+
+/* Read the name of a work unit FILE.unitI-of-N: the length of FILE, I and
+   N. False for other names. */
+static bool unit_parser (const char *name, size_t *length, size_t *index,
+                         size_t *count)
+{
+  const char *suffix = NULL;
+  for (const char *p = strstr(name, ".unit"); p; p = strstr(p + 1, ".unit"))
+    suffix = p;
+  if (!suffix)
+    return false;
+
+  char *end;
+  const char *start = suffix + 5;
+  if (*start < '0' || *start > '9')
+    return false;
+  *index = strtoull(start, &end, 10);
+  if (strncmp(end, "-of-", 4))
+    return false;
+  start = end + 4;
+  if (*start < '0' || *start > '9')
+    return false;
+  *count = strtoull(start, &end, 10);
+  if (*end != '\n' && *end != '\0')
+    return false;
+  *length = suffix - name;
+  return *index >= 1 && *index <= *count;
+}
+
+/* Combine the outputs of runs over work units: the solutions they found,
+   only the first one unless all is set, and the sum of their numbers of
+   solutions. An output can hold the results of several units. The sum is
+   only given when every unit of the split is there exactly once. */
+static bool result_merger (char *files[], const int count, const bool all,
+                           FILE *stream)
+{
+  char line[4096];
+  size_t units = 0;
+  size_t total = 0;
+  bool unknown = false;
+  bool first_done = false;
+  bool printing = false;
+  bool all_good = true;
+  char *split = NULL;  /* FILE of the units, NULL before the first one */
+  size_t expected = 0;
+  bool *seen = NULL;
+  for (int i = 0; i < count; ++i) {
+    FILE *file = fopen(files[i], "r");
+    if (!file)
+      errx(EXIT_FAILURE, "error: file %s can not be read!", files[i]);
+    bool in_result = false;
+    while (fgets(line, sizeof(line), file)) {
+      if (!strncmp(line, "Solving : ", 10)) {
+        ++units;
+        in_result = true;
+        printing = false;
+
+        char *name = line + 10;
+        size_t length, index, total_units;
+        bool valid = unit_parser(name, &length, &index, &total_units);
+        if (valid && !split) {
+          split = strndup(name, length);
+          expected = total_units;
+          seen = calloc(total_units, sizeof(bool));
+          if (!split || !seen)
+            errx(EXIT_FAILURE, "error: can't allocate the units of %s!",
+                 files[i]);
+        }
+        if (!valid || total_units != expected ||
+            strlen(split) != length || strncmp(split, name, length)) {
+          name[strcspn(name, "\n")] = '\0';
+          warnx("warning: %s is not a unit of the split", name);
+          unknown = true;
+          all_good = false;
+        }
+        else if (seen[index - 1]) {
+          warnx("warning: unit %zu given twice", index);
+          unknown = true;
+          all_good = false;
+        }
+        else
+          seen[index - 1] = true;
       }
-      else if (n > 0) {
-        warnx("error: line %zu is malformed! (wrong number of columns)", line);
-        grid_free(grid);
-        fclose(stream);
-        return NULL;
+      else if (!strncmp(line, "Number of solutions: ", 21)) {
+        char *end;
+        size_t solutions = strtoull(line + 21, &end, 10);
+        if (end == line + 21 ||
+            __builtin_add_overflow(total, solutions, &total)) {
+          warnx("warning: incomplete result in %s", files[i]);
+          unknown = true;
+          all_good = false;
+        }
+        in_result = false;
       }
-      if (ch == EOF)
-        break;
-      line++;
-      continue;
-    }
-    if (!comment) {
-      switch (ch) {
-        case ' ':
-        case '\t':
-          break;
-
-        case '#':
-          comment = true;
-          break;
-
-        default:
-          if (n >= grid_get_size(grid)) {
-            warnx("error: line %zu is malformed! (wrong number of columns)", line);
-            grid_free(grid);
-            fclose(stream);
-            return NULL;
-          }
-          if (row >= grid_get_size(grid)) {
-            warnx("error: grid has extra lines starting from line %zu!", line);
-            grid_free(grid);
-            fclose(stream);
-            return NULL;
-          }
-          if (grid_check_char(grid, ch)) {
-            grid_set_cell(grid, row, n, ch);
-            n++;
+      else if (in_result && (all || !first_done)) {
+        /* Lines of a solution, up to the blank line that ends it */
+        if (line[0] == '\n') {
+          if (printing) {
+            fputs(line, stream);
+            first_done = true;
           }
-          else {
-            warnx("error: wrong character '%c' at line %zu!", ch, line);
-            grid_free(grid);
-            fclose(stream);
-            return NULL;
-          }
-          break;
+          printing = false;
+        }
+        else {
+          printing = true;
+          fputs(line, stream);
+        }
       }
     }
+    if (in_result) {
+      warnx("warning: truncated result in %s", files[i]);
+      unknown = true;
+      all_good = false;
+    }
+    fclose(file);
   }
-  
-  if (row < grid_get_size(grid)) {
-    warnx("error: grid has %zu missing line(s)", grid_get_size(grid) - row);
-    grid_free(grid);
-    fclose(stream);
-    return NULL;
+
+  size_t missing = expected;
+  for (size_t u = 0; u < expected; ++u)
+    missing -= seen[u];
+  if (!split) {
+    warnx("warning: no work unit to merge");
+    unknown = true;
+    all_good = false;
   }
-  fclose(stream);
-  
-  return grid;
+  else if (missing) {
+    warnx("warning: %zu of %zu units missing", missing, expected);
+    unknown = true;
+    all_good = false;
+  }
+  free(split);
+  free(seen);
+
+  fprintf(stream, "Merged units: %zu \n", units);
+  if (unknown)
+    fprintf(stream, "Number of solutions: unknown \n");
+  else
+    fprintf(stream, "Number of solutions: %zu \n", total);
+  return all_good;
 }
 
-static grid_t *grid_solver (grid_t *grid, const mode_t mode, FILE* stream, bool random)
+/* Classes of the characters of a result, besides colors */
+#define CHAR_BLANK 0
+#define CHAR_COMMENT -1
+#define CHAR_HEADER -2
+#define CHAR_OTHER -3
+
+/* Lines of a result */
+typedef enum { LINE_BLANK, LINE_COMMENT, LINE_HEADER, LINE_ROW } line_kind_t;
+
+/* Grid of a result being verified, and the clues of its puzzle */
+typedef struct
+{
+  int8_t classes[256];
+  size_t size;
+  size_t rows;
+  bool numeric;
+  bool malformed;
+  size_t line;
+  uint8_t cells[MAX_GRID_SIZE * MAX_GRID_SIZE];
+  char *puzzle;
+  size_t clues_size;
+  uint8_t clues[MAX_GRID_SIZE * MAX_GRID_SIZE];
+} verifier_t;
+
+/* Load the clues of the puzzle named by a "Solving : " line, kept while
+   the following results name the same one */
+static void verifier_puzzle (verifier_t *verifier, const char *name)
 {
+  if (verifier->puzzle && !strcmp(verifier->puzzle, name))
+    return;
+  free(verifier->puzzle);
+  verifier->puzzle = strdup(name);
+  verifier->clues_size = 0;
+
+  FILE *file = fopen(name, "r");
+  if (!file) {
+    warnx("warning: puzzle %s can not be read, its clues are not checked",
+          name);
+    return;
+  }
+  fclose(file);
+  grid_t *grid = file_parser((char *) name);
   if (!grid)
-    return NULL;
-  
-  size_t c = grid_heuristics(grid);
-  if (c == NOT_CONSISTENT) {
-    grid_free(grid);
-    return NULL;
+    return;
+  size_t size = grid_get_size(grid);
+  for (size_t i = 0; i < size; ++i)
+    for (size_t j = 0; j < size; ++j) {
+      colors_t colors = grid_get_colors(grid, i, j);
+      verifier->clues[i * size + j] =
+        colors_is_singleton(colors) ? colors_index(colors) + 1 : 0;
+    }
+  verifier->clues_size = size;
+  grid_free(grid);
+}
+
+/* Read the cells of a line in the grid being verified, in a single pass.
+   The first row gives the size and the syntax of the grid. */
+static line_kind_t verifier_line (verifier_t *verifier, const char *line,
+                                  const char *end)
+{
+  size_t limit = verifier->rows ? verifier->size : MAX_GRID_SIZE;
+  if (verifier->rows >= limit)
+    limit = 0;
+  uint8_t *cells = verifier->cells + verifier->rows * verifier->size;
+  size_t count = 0;
+  size_t words = 0;
+  bool word = false;
+  bool comment = false;
+  for (const char *c = line; c < end && !comment; ++c) {
+    int8_t class = verifier->classes[(unsigned char) *c];
+    if (class > 0 || class == CHAR_OTHER) {
+      if (count < limit)
+        cells[count] = class > 0 ? class : 0;
+      ++count;
+      words += !word;
+      word = true;
+    }
+    else if (class == CHAR_BLANK)
+      word = false;
+    else if (class == CHAR_COMMENT)
+      comment = true;
+    else
+      return LINE_HEADER;
   }
-  if (c == SOLVED) {
-    solutions++;
-    if (stream)
-      grid_print(grid, stream);
-    return grid;
+  if (count == 0)
+    return comment ? LINE_COMMENT : LINE_BLANK;
+
+  if (verifier->rows == 0) {
+    verifier->numeric = words > COLOR_TABLE_SIZE;
+    verifier->size = verifier->numeric ? words : count;
+    verifier->malformed = !grid_check_size(verifier->size);
   }
-  
-  choice_t *choice = grid_choice(grid, random);
-  grid_t *last = NULL;
-  while (!grid_choice_is_empty(choice)) {
-    grid_t *grid_new = grid_copy(grid);
-    grid_choice_apply(grid_new, choice);
-    grid_t *result = grid_solver(grid_new, mode, stream, random);
-    if (result) {
-      if (mode == mode_first) {
-        grid_choice_free(choice);
-        grid_free(grid);
-        return result;
+  if (verifier->numeric) {
+    /* Colors 1 to N separated by blanks, anything else is not a color */
+    count = 0;
+    for (const char *c = line; c < end && *c != '#'; ) {
+      if (verifier->classes[(unsigned char) *c] == CHAR_BLANK) {
+        ++c;
+        continue;
       }
-      else {
-        if (last)
-          grid_free(last);
-        last = result;
+      size_t color = 0;
+      bool valid = true;
+      for (; c < end && *c != '#' &&
+             verifier->classes[(unsigned char) *c] != CHAR_BLANK; ++c) {
+        valid = valid && *c >= '0' && *c <= '9';
+        color = 10 * color + (*c - '0');
+        valid = valid && color <= MAX_GRID_SIZE;
       }
+      if (count < limit)
+        cells[count] = valid ? color : 0;
+      ++count;
     }
-    grid_choice_discard(grid, choice);
-    grid_choice_free(choice);
-    if (!grid_is_consistent(grid)) {
-      grid_free(grid);
-      if (mode == mode_first)
-        return NULL;
-      return last;
-    }
-    choice = grid_choice(grid, random);
   }
-  grid_choice_free(choice);
-  grid_free(grid);
-  if (mode == mode_all)
-    return last;
-  return NULL;
+  if (count != verifier->size || verifier->rows >= verifier->size)
+    verifier->malformed = true;
+  ++verifier->rows;
+  return LINE_ROW;
 }
 
-static grid_t *grid_generator (size_t size, const mode_t mode)
+/* Check the grid read so far, when there is one */
+static void verifier_check (verifier_t *verifier, const char *path,
+                            size_t *grids, size_t *valid_grids)
 {
-  grid_t *grid = grid_alloc(size);
-  if (!grid)
-    return NULL;
-    
-  /* PRNG need to be initialized with srand() before calling this function */
-  size_t total = size * size;
-  grid_initialize(grid);
-  grid = grid_solver(grid, mode_first, NULL, true);
-  size_t *pos = malloc(total*sizeof(size_t));
-  for (size_t i = 0; i < total; i ++)
-    pos[i] = i;
-  for (size_t i = total - 1; i > 0; --i) {
-    size_t j = rand() % i;
-    size_t temp = pos[i];
-    pos[i] = pos[j];
-    pos[j] = temp;
-  }
-  size_t count = total * EMPTY_RATE;
-  if (mode == mode_first)
-    for (size_t i = 0; i < count; ++i) 
-      grid_set_cell(grid, pos[i] / size, pos[i] % size, EMPTY_CELL);
-  else {
-    for (size_t i = 0; i < total; ++i) {
-      solutions = 0;
-      grid_t *copy = grid_copy(grid);
-      grid_set_cell(copy, pos[i] / size, pos[i] % size, EMPTY_CELL);
-      copy = grid_solver(copy, mode_all, NULL, false);
-      if (solutions == 1) {
-        grid_set_cell(grid, pos[i] / size, pos[i] % size, EMPTY_CELL);
-        --count;
+  if (verifier->rows == 0)
+    return;
+
+  ++*grids;
+  size_t size = verifier->size;
+  bool valid = !verifier->malformed && verifier->rows == size;
+  bool clues = valid && verifier->clues_size == size;
+  if (valid)
+    valid = grid_verify(verifier->cells, size,
+                        clues ? verifier->clues : NULL);
+  if (!valid && clues)
+    warnx("warning: grid at line %zu of %s is not a solution of %s",
+          verifier->line, path, verifier->puzzle);
+  else if (!valid)
+    warnx("warning: grid at line %zu of %s is not a solved grid",
+          verifier->line, path);
+  verifier->rows = 0;
+  verifier->malformed = false;
+  *valid_grids += valid;
+}
+
+/* Check the solved grids of files, separated by blank lines, such as the
+   output of sudoku -a: each grid must be complete and valid, and keep the
+   clues of the puzzle named by the last "Solving : " line if any. Lines
+   holding a ':', never a color, are not part of the grids. Files are read
+   by large blocks and each line is only scanned once. */
+static bool result_verifier (char *files[], const int count, FILE *stream)
+{
+  verifier_t *verifier = malloc(sizeof(verifier_t));
+  size_t capacity = 1 << 20;
+  char *buffer = malloc(capacity);
+  if (!verifier || !buffer)
+    errx(EXIT_FAILURE, "error: out of memory!");
+  for (size_t c = 0; c < 256; ++c)
+    verifier->classes[c] = CHAR_OTHER;
+  for (size_t i = 0; i < COLOR_TABLE_SIZE; ++i)
+    verifier->classes[(unsigned char) color_table[i]] = i + 1;
+  verifier->classes[' '] = CHAR_BLANK;
+  verifier->classes['\t'] = CHAR_BLANK;
+  verifier->classes['\r'] = CHAR_BLANK;
+  verifier->classes['#'] = CHAR_COMMENT;
+  verifier->classes[':'] = CHAR_HEADER;
+  verifier->puzzle = NULL;
+
+  bool all_good = true;
+  for (int i = 0; i < count; ++i) {
+    FILE *file = fopen(files[i], "r");
+    if (!file)
+      errx(EXIT_FAILURE, "error: file %s can not be read!", files[i]);
+    fprintf(stream, "Verifying : %s\n", files[i]);
+
+    size_t grids = 0;
+    size_t valid = 0;
+    size_t number = 0;
+    verifier->rows = 0;
+    verifier->malformed = false;
+    verifier->clues_size = 0;
+    free(verifier->puzzle);
+    verifier->puzzle = NULL;
+
+    size_t length = 0;
+    size_t start = 0;
+    bool eof = false;
+    while (true) {
+      char *line = buffer + start;
+      char *end = memchr(line, '\n', length - start);
+      if (!end) {
+        if (eof) {
+          if (start == length)
+            break;
+          end = buffer + length;
+        }
+        else {
+          /* Keep the partial line at the front, and read after it */
+          length -= start;
+          memmove(buffer, line, length);
+          start = 0;
+          if (length == capacity) {
+            capacity *= 2;
+            char *larger = realloc(buffer, capacity);
+            if (!larger)
+              errx(EXIT_FAILURE, "error: out of memory!");
+            buffer = larger;
+          }
+          size_t read = fread(buffer + length, 1, capacity - length, file);
+          length += read;
+          eof = read == 0;
+          continue;
+        }
+      }
+      start = (end < buffer + length) ? (size_t) (end - buffer) + 1 : length;
+      ++number;
+
+      line_kind_t kind = verifier_line(verifier, line, end);
+      if (kind == LINE_ROW) {
+        if (verifier->rows == 1)
+          verifier->line = number;
+        continue;
+      }
+      if (kind == LINE_COMMENT)
+        continue;
+      verifier_check(verifier, files[i], &grids, &valid);
+      if (kind == LINE_HEADER && end - line > 10 &&
+          !strncmp(line, "Solving : ", 10)) {
+        char *name = strndup(line + 10, end - line - 10);
+        if (!name)
+          errx(EXIT_FAILURE, "error: out of memory!");
+        verifier_puzzle(verifier, name);
+        free(name);
       }
-      grid_free(copy);
-      if (count == 0)
-        break;
     }
+    verifier_check(verifier, files[i], &grids, &valid);
+    fclose(file);
+
+    fprintf(stream, "Valid grids: %zu of %zu \n", valid, grids);
+    if (valid < grids)
+      all_good = false;
   }
-  free(pos);
-  return grid;
+  free(buffer);
+  free(verifier->puzzle);
+  free(verifier);
+  return all_good;
+}
+
+/* Print a number given by its log10, in scientific notation when large */
+static void magnitude_printer (FILE *stream, const double value)
+{
+  if (isinf(value))
+    fputs((value < 0) ? "0" : "inf", stream);
+  else if (value < 15)
+    fprintf(stream, "%.0f", pow(10, value));
+  else {
+    double exponent = floor(value);
+    fprintf(stream, "%.3fe%.0f", pow(10, value - exponent), exponent);
+  }
+}
+
+/* Write the trace at exit */
+static void trace_exit (void)
+{
+  if (!trace_stop())
+    warnx("error: can't write the trace!");
+}
+
+/* Progress callback of long counts */
+static void progress_printer (size_t solutions, size_t nodes, void *data)
+{
+  (void) data;
+  fprintf(stderr, "Progress: %zu solutions, %zu nodes\n", solutions, nodes);
+}
+
+/* Grids of the files being solved, read BOARD_LANES files ahead so that the
+   9x9 ones are propagated together: those settled by propagation alone are
+   not searched */
+typedef struct
+{
+  int first;                     /* index of the first file */
+  int count;
+  grid_t *grids[BOARD_LANES];    /* NULL if the file can't be parsed */
+  char errors[BOARD_LANES][128]; /* why, reported in the order of the files */
+  grid_t *settled[BOARD_LANES];  /* propagated grid, NULL if still open */
+  size_t results[BOARD_LANES];   /* SOLVED or NOT_CONSISTENT if settled */
+} batch_t;
+
+/* Read the files first to first + count - 1 into the batch, and propagate
+   them if asked. Files that can't be opened are left to the solving loop
+   to report. */
+static void batch_parser (batch_t *batch, char *files[], const int first,
+                          const int count, const bool propagate)
+{
+  batch->first = first;
+  batch->count = count;
+  for (int i = 0; i < count; ++i) {
+    batch->grids[i] = NULL;
+    batch->settled[i] = NULL;
+    batch->errors[i][0] = '\0';
+    if (access(files[first + i], R_OK) == 0)
+      batch->grids[i] = file_reader(files[first + i], batch->errors[i],
+                                    sizeof(batch->errors[i]));
+    if (propagate && batch->grids[i] && grid_get_size(batch->grids[i]) == 9)
+      batch->settled[i] = grid_copy(batch->grids[i]);
+  }
+  if (!propagate)
+    return;
+  board_heuristics(batch->settled, count, batch->results);
+  for (int i = 0; i < count; ++i)
+    if (batch->results[i] == CONSISTENT_NOT_SOLVED) {
+      grid_free(batch->settled[i]);
+      batch->settled[i] = NULL;
+    }
 }
 
 int main(int argc, char* argv[]) 
 {
   bool solver = true;
+  size_t memory_limit = 0;
+  size_t timeout = 0;
+  size_t max_nodes = 0;
+  size_t portfolio = 1;
+  size_t threads = 1;
+  bool restarts = false;
+  bool search_fill = false;
+  char *socket_path = NULL;
+  size_t workers = 0;
+  size_t cache_capacity = 0;
+  char *store_path = NULL;
   bool has_output_file = false;
   int optc;
   int args = 1;
   const struct option longopts[] = {
     { "all", no_argument, NULL, 'a' },
+    { "count", no_argument, NULL, 'c' },
     { "unique", no_argument, NULL, 'u' },
     { "help" , no_argument, NULL, 'h' },
     { "version", no_argument, NULL, 'V' },
     { "verbose", no_argument, NULL, 'v' },
     { "output", required_argument, NULL, 'o' },
+    { "memory", required_argument, NULL, 'm' },
+    { "timeout", required_argument, NULL, 't' },
+    { "max-nodes", required_argument, NULL, 'n' },
+    { "portfolio", required_argument, NULL, 'P' },
+    { "parallel", required_argument, NULL, 'p' },
+    { "restarts", no_argument, NULL, 'r' },
+    { "search-fill", no_argument, NULL, 's' },
     { "generate", optional_argument, NULL, 'g' },
+    { "serve", required_argument, NULL, 'S' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "cache", required_argument, NULL, 'C' },
+    { "disk-cache", required_argument, NULL, 'D' },
+    { "trace", required_argument, NULL, 'T' },
+    { "split", required_argument, NULL, 'd' },
+    { "merge", no_argument, NULL, 'M' },
+    { "verify", no_argument, NULL, 'k' },
+    { "estimate", no_argument, NULL, 'e' },
     { NULL, 0, NULL, 0}
   };
-  const char* opt = "g::o:abhVvu";
+  const char* opt = "g::o:m:t:n:P:p:S:j:C:D:T:d:abcehkMrsVvu";
   char* buffer;
   FILE* stream = stdout;
   bool all = false;
+  bool count = false;
   bool unique = false;
+  size_t split_depth = 0;
+  bool merge = false;
+  bool verify = false;
+  bool estimate = false;
   size_t size = 9;
   while ((optc = getopt_long (argc, argv, opt, longopts, NULL)) != -1) {
     args = optind;
@@ -291,21 +698,61 @@ int main(int argc, char* argv[])
         all = true;
         break;
 
+      case 'c':
+        count = true;
+        break;
+
       case 'u':
         unique = true;
         break;
 
       case 'h':
         buffer = 
-          "Usage: sudoku [-a | -o FILE | -v | -V | -h] FILE...\n"
-          "       sudoku -g[SIZE] [-u | -o FILE | -v | -V | -h]\n"
-          "Solve or generate Sudoku grids of various sizes (1,4,9,16,25,36,49,64)\n"
+          "Usage: sudoku [-a | -c | -C N | -D FILE | -m SIZE | -t MS | -n N | -P N | -r |\n"
+          "               -p N | -o FILE | -T FILE | -v | -V | -h] FILE...\n"
+          "       sudoku -g[SIZE] [-u | -s | -m SIZE | -t MS | -n N | -p N | -o FILE |\n"
+          "               -T FILE | -v | -V | -h]\n"
+          "       sudoku -d DEPTH [-o FILE | -v | -V | -h] FILE...\n"
+          "       sudoku -M [-a | -o FILE | -v | -V | -h] RESULT...\n"
+          "       sudoku -k [-o FILE | -v | -V | -h] RESULT...\n"
+          "       sudoku -e [-t MS | -n N | -o FILE | -v | -V | -h] FILE...\n"
+          "       sudoku -S SOCKET [-j N | -C N | -D FILE | -m SIZE | -t MS | -n N]\n"
+          "Solve or generate Sudoku grids of various sizes (" GRID_SIZES ")\n"
           "\n"
           " -a, --all              search for all possible solutions\n"
+          " -c, --count            only count the solutions\n"
+          " -e, --estimate         estimate the number of solutions with random\n"
+          "                        probes, within -t MS (default: 1000) or -n N\n"
           " -g[N], --generate[=N]  generate a grid of size NxN (default:9)\n"
           " -u, --unique           generate a grid with unique solution\n"
+          " -s, --search-fill      generate from a grid solved by a random search\n"
+          "                        instead of a shuffled pattern\n"
+          " -m SIZE, --memory SIZE abort the search above SIZE bytes (K,M,G)\n"
+          " -t MS, --timeout MS    give up on a grid after MS milliseconds\n"
+          " -n N, --max-nodes N    give up on a grid after N search nodes (K,M,G)\n"
+          " -P N, --portfolio N    race N differently seeded searches on threads for\n"
+          "                        the first solution\n"
+          " -r, --restarts         restart random searches on a Luby schedule\n"
+          " -p N, --parallel N     propagate grids of 36x36 and more on N threads\n"
+          " -C N, --cache N        reuse the results of the last N grids, up to\n"
+          "                        symmetries\n"
+          " -D FILE, --disk-cache FILE\n"
+          "                        keep the results in FILE, shared by all runs\n"
+          "                        (created for the size of the first grid)\n"
           " -o FILE, --output FILE write solution to FILE\n"
-          " -v, --verbose          verbose output\n"
+          " -T FILE, --trace FILE  write a Chrome trace of the hot paths to FILE\n"
+          "                        (needs a build with make TRACE=1)\n"
+          " -d DEPTH, --split DEPTH\n"
+          "                        split the search into the subtrees open after\n"
+          "                        DEPTH decisions, written to FILE.unit1-of-N...\n"
+          " -M, --merge            combine the outputs of runs over work units:\n"
+          "                        total count, first solution (all with -a)\n"
+          " -k, --verify           check that the grids of the results are solved,\n"
+          "                        and keep the clues of their \"Solving :\" puzzle\n"
+          " -S SOCKET, --serve SOCKET\n"
+          "                        serve requests on the Unix socket SOCKET\n"
+          " -j N, --jobs N         number of solver threads of the server\n"
+          " -v, --verbose          verbose output, report progress of counts\n"
           " -V, --version          display version and exit\n"
           " -h, --help             display this help and exit\n";
         fputs(buffer, stream);
@@ -314,7 +761,7 @@ int main(int argc, char* argv[])
       case 'V':
         buffer = 
           "sudoku %d.%d.%d\n"
-          "Solve/generate sudoku grids (possible sizes: 1,4,9,16,25,36,49,64)\n";
+          "Solve/generate sudoku grids (possible sizes: " GRID_SIZES ")\n";
         fprintf(stream, buffer, VERSION, SUBVERSION, REVISION);
         return EXIT_SUCCESS;
 
@@ -333,12 +780,90 @@ int main(int argc, char* argv[])
           warnx("warning: 2 output files detected, use only the first one!");
         break;
 
+      case 'm':
+        if (!size_parser(optarg, &memory_limit))
+          errx(EXIT_FAILURE, "error: invalid memory size %s", optarg);
+        break;
+
+      case 't':
+        if (!number_parser(optarg, SIZE_MAX, &timeout) || timeout == 0)
+          errx(EXIT_FAILURE, "error: invalid timeout %s", optarg);
+        break;
+
+      case 'n':
+        if (!size_parser(optarg, &max_nodes) || max_nodes == 0)
+          errx(EXIT_FAILURE, "error: invalid number of nodes %s", optarg);
+        break;
+
+      case 'P':
+        if (!number_parser(optarg, SOLVER_MAX_PORTFOLIO, &portfolio) ||
+            portfolio == 0)
+          errx(EXIT_FAILURE, "error: invalid number of threads %s", optarg);
+        break;
+
+      case 'r':
+        restarts = true;
+        break;
+
+      case 's':
+        search_fill = true;
+        break;
+
+      case 'T':
+        if (trace_start(optarg))
+          atexit(trace_exit);
+        else
+          warnx("warning: tracing is not built in (make TRACE=1), disabled");
+        break;
+
+      case 'S':
+        socket_path = optarg;
+        break;
+
+      case 'p':
+        if (!number_parser(optarg, MAX_THREADS, &threads) || threads == 0)
+          errx(EXIT_FAILURE, "error: invalid number of threads %s", optarg);
+        break;
+
+      case 'j':
+        if (!number_parser(optarg, MAX_THREADS, &workers) || workers == 0)
+          errx(EXIT_FAILURE, "error: invalid number of jobs %s", optarg);
+        break;
+
+      case 'C':
+        if (!number_parser(optarg, SIZE_MAX, &cache_capacity) ||
+            cache_capacity == 0)
+          errx(EXIT_FAILURE, "error: invalid cache size %s", optarg);
+        break;
+
+      case 'D':
+        store_path = optarg;
+        break;
+
+      case 'd':
+        if (!number_parser(optarg, SIZE_MAX, &split_depth) ||
+            split_depth == 0)
+          errx(EXIT_FAILURE, "error: invalid split depth %s", optarg);
+        break;
+
+      case 'M':
+        merge = true;
+        break;
+
+      case 'k':
+        verify = true;
+        break;
+
+      case 'e':
+        estimate = true;
+        break;
+
       case 'g':
         solver = false;
         if (optarg) {
           size = atoi(optarg);
           if (!grid_check_size(size))
-            errx(EXIT_FAILURE, "error: invalid grid size, only (1,4,9,16,25,36,49,64)!");
+            errx(EXIT_FAILURE, "error: invalid grid size, only (" GRID_SIZES ")!");
         }
         break;
 
@@ -354,43 +879,224 @@ int main(int argc, char* argv[])
     warnx("warning: option 'all' conflict with the generator mode, disabled");
     all = false;
   }
+  if (!solver && count) {
+    warnx("warning: option 'count' conflict with the generator mode, disabled");
+    count = false;
+  }
+  else if (all && count) {
+    warnx("warning: option 'all' conflict with option 'count', disabled");
+    all = false;
+  }
+
+  if (socket_path) {
+    server_options_t options = {
+      .workers = workers,
+      .memory_limit = memory_limit,
+      .timeout = timeout,
+      .max_nodes = max_nodes,
+      .cache = cache_capacity,
+      .store = store_path,
+      .seed = time(NULL) - getpid()
+    };
+    server_run(socket_path, &options);
+    return EXIT_FAILURE;
+  }
+
+  solver_t *context = solver_new();
+  if (!context)
+    errx(EXIT_FAILURE, "error: can't allocate the solver!");
+  solver_set_memory_limit(context, memory_limit);
+  if (estimate && !timeout && !max_nodes)
+    timeout = ESTIMATE_TIMEOUT;
+  solver_set_timeout(context, timeout);
+  solver_set_max_nodes(context, max_nodes);
+  solver_set_portfolio(context, portfolio);
+  if (threads > 1 && !grid_set_threads(threads))
+    warnx("warning: can't start the propagation threads, disabled");
+  solver_set_restarts(context, restarts);
+  solver_set_search_fill(context, search_fill);
+  cache_t *cache = NULL;
+  if (cache_capacity) {
+    cache = cache_new(cache_capacity);
+    if (!cache)
+      warnx("warning: can't allocate the cache, disabled");
+    solver_set_cache(context, cache);
+  }
+  store_t *store = NULL;
+  solver_set_seed(context, time(NULL) - getpid());
 
   FILE *file;
   bool all_good = true;
-  if (solver) {
+  if (verify) {
+    if (args == argc)
+      errx(EXIT_FAILURE, "error: no result file given!");
+    all_good = result_verifier(argv + args, argc - args, stream);
+  }
+  else if (estimate) {
+    if (args == argc)
+      errx(EXIT_FAILURE, "error: no input grid given!");
+    for (int i = args; i < argc; i++) {
+      fprintf(stream, "Estimating : %s\n", argv[i]);
+      grid_t *grid = file_parser(argv[i]);
+      if (grid == NULL) {
+        all_good = false;
+        continue;
+      }
+      solver_estimate_t result;
+      solver_status_t status = solver_estimate(context, grid, 0, &result);
+      if (status == SOLVER_OUT_OF_MEMORY) {
+        warnx("error: memory limit reached, estimate aborted!");
+        all_good = false;
+      }
+      else if (status == SOLVER_UNKNOWN)
+        warnx("warning: no probe out of %zu reached a solution, the grid "
+              "may have none", result.probes);
+      fprintf(stream, "Estimated solutions: ");
+      magnitude_printer(stream, result.log10_count);
+      fprintf(stream, " (95%% interval: ");
+      magnitude_printer(stream, result.log10_low);
+      fprintf(stream, " to ");
+      magnitude_printer(stream, result.log10_high);
+      fprintf(stream, ", %zu probes) \n", result.probes);
+      grid_free(grid);
+    }
+  }
+  else if (merge) {
+    if (args == argc)
+      errx(EXIT_FAILURE, "error: no result file given!");
+    all_good = result_merger(argv + args, argc - args, all, stream);
+  }
+  else if (split_depth) {
+    if (args == argc)
+      errx(EXIT_FAILURE, "error: no input grid given!");
+    for (int i = args; i < argc; i++) {
+      fprintf(stream, "Splitting : %s\n", argv[i]);
+      grid_t *grid = file_parser(argv[i]);
+      if (grid == NULL) {
+        all_good = false;
+        continue;
+      }
+      splitter_t splitter = { argv[i], 0, false };
+      solver_status_t status = solver_split(context, grid, split_depth,
+                                            unit_writer, &splitter);
+      if (status == SOLVER_OUT_OF_MEMORY) {
+        warnx("error: memory limit reached, split aborted!");
+        all_good = false;
+      }
+      else if (status == SOLVER_UNSOLVABLE) {
+        warnx("error: the initial grid is inconsistent!");
+        all_good = false;
+      }
+      else if (status == SOLVER_UNKNOWN) {
+        warnx("error: budget exceeded, split aborted!");
+        all_good = false;
+      }
+      if (status == SOLVER_SOLVED && !splitter.failed &&
+          !unit_namer(&splitter))
+        splitter.failed = true;
+      if (splitter.failed)
+        all_good = false;
+      fprintf(stream, "Number of units: %zu \n", splitter.count);
+      grid_free(grid);
+    }
+  }
+  else if (solver) {
     if (args == argc)
       errx(EXIT_FAILURE, "error: no input grid given!");
-    srand(time(NULL) - getpid());
+    solver_mode_t mode = (all) ? mode_all : mode_first;
+    if (count)
+      mode = mode_count;
+    solver_set_mode(context, mode);
+    solver_set_random(context, (mode == mode_first) ? true : false);
+    solver_set_callback(context, solution_printer, stream);
+    if (verbose)
+      solver_set_progress(context, progress_printer, PROGRESS_INTERVAL, NULL);
+    /* Results settled by propagation would miss the cache and the store,
+       the files are then solved one by one */
+    bool batching = !cache && !store_path;
+    batch_t batch = { .first = args, .count = 0 };
     for (int i = args; i < argc; i++) {
+      if (i == batch.first + batch.count)
+        batch_parser(&batch, argv, i,
+                     (!batching) ? 1 :
+                     (argc - i < BOARD_LANES) ? argc - i : BOARD_LANES,
+                     batching);
       if ((file = fopen(argv[i], "r")) == NULL)
         errx(EXIT_FAILURE, "error: file %s can not be read!", argv[i]);
       fprintf(stream, "Solving : %s\n", argv[i]);
-      grid_t *grid = file_parser(argv[i]);
+      grid_t *grid = batch.grids[i - batch.first];
+      grid_t *settled = batch.settled[i - batch.first];
       if (grid == NULL) {
+        warnx("error: %s", batch.errors[i - batch.first]);
         fclose(file);
         all_good = false;
         continue;
       }
-      mode_t mode = (all) ? mode_all : mode_first;
-      bool random = (all) ? false : true;
-      solutions = 0;
-      grid = grid_solver(grid, mode, stream, random);
-      if (!grid) {
+      if (store_path && !store) {
+        store = store_open(store_path, grid_get_size(grid));
+        if (!store)
+          warnx("warning: can't open the disk cache %s, disabled", store_path);
+        store_path = NULL;
+        solver_set_store(context, store);
+      }
+      solver_status_t status;
+      size_t solutions;
+      if (!settled) {
+        status = solver_solve(context, grid);
+        solutions = solver_get_solutions(context);
+      }
+      else if (batch.results[i - batch.first] == SOLVED) {
+        if (mode != mode_count)
+          grid_print(settled, stream);
+        status = SOLVER_SOLVED;
+        solutions = 1;
+      }
+      else {
+        status = SOLVER_UNSOLVABLE;
+        solutions = 0;
+      }
+      if (status == SOLVER_OUT_OF_MEMORY) {
+        warnx("error: memory limit reached, search aborted!");
+        all_good = false;
+      }
+      else if (status == SOLVER_UNSOLVABLE) {
         warnx("error: the initial grid is inconsistent!");
         all_good = false;
       }
-      fprintf(stream, "Number of solutions: %ld \n", solutions);
+      else if (status == SOLVER_UNKNOWN) {
+        warnx("error: budget exceeded, search aborted!");
+        all_good = false;
+      }
+      if (status == SOLVER_UNKNOWN)
+        fprintf(stream, "Number of solutions: unknown \n");
+      else
+        fprintf(stream, "Number of solutions: %zu \n", solutions);
       grid_free(grid);
+      grid_free(settled);
       fclose(file);
     }
   }
   else {
-    srand(time(NULL) - getpid());
-    mode_t mode = (unique) ? mode_unique : mode_first;
-    grid_t *grid = grid_generator(size, mode);
+    solver_status_t status;
+    grid_t *grid = solver_generate(context, size, unique, &status);
+    if (!grid) {
+      warnx("error: can't generate a grid of size %zu!", size);
+      all_good = false;
+    }
+    else if (status == SOLVER_OUT_OF_MEMORY) {
+      warnx("error: memory limit reached, the grid is partly carved!");
+      all_good = false;
+    }
+    else if (status == SOLVER_UNKNOWN) {
+      warnx("error: budget exceeded, the grid is partly carved!");
+      all_good = false;
+    }
     grid_print(grid, stream);
     grid_free(grid);
   }
+  solver_free(context);
+  cache_free(cache);
+  store_close(store);
   fclose(stream);
   if (!all_good)
     return EXIT_FAILURE;
@@ -4,7 +4,6 @@
 #define VERSION 1
 #define SUBVERSION 0
 #define REVISION 0
-#define EMPTY_RATE 0.4
 
 #endif /* SUDOKU_H */
 
@@ -0,0 +1,161 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+
+#ifdef TRACE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct
+{
+  const char *name;
+  uint64_t start;
+  uint64_t end;
+} event_t;
+
+/* Spans of a thread, the last TRACE_RING_SIZE of count */
+typedef struct ring_t ring_t;
+
+struct ring_t
+{
+  ring_t *next;
+  size_t thread;
+  size_t count;
+  event_t events[TRACE_RING_SIZE];
+};
+
+bool trace_enabled = false;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *trace_path = NULL;
+static ring_t *trace_rings = NULL;
+static size_t trace_threads = 0;
+static uint64_t trace_origin;
+static uint64_t clock_origin;
+
+static _Thread_local ring_t *thread_ring = NULL;
+static _Thread_local bool thread_failed = false;
+
+static uint64_t clock_nanoseconds (void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Ring buffer of the calling thread, allocated at its first span */
+static ring_t *trace_ring (void)
+{
+  if (thread_ring || thread_failed)
+    return thread_ring;
+
+  ring_t *ring = malloc(sizeof(ring_t));
+  if (!ring) {
+    thread_failed = true;
+    return NULL;
+  }
+  ring->count = 0;
+  pthread_mutex_lock(&trace_lock);
+  ring->thread = ++trace_threads;
+  ring->next = trace_rings;
+  trace_rings = ring;
+  pthread_mutex_unlock(&trace_lock);
+  thread_ring = ring;
+  return ring;
+}
+
+void trace_end (trace_span_t *span)
+{
+  if (!span->start)
+    return;
+
+  uint64_t end = trace_clock();
+  ring_t *ring = trace_ring();
+  if (!ring)
+    return;
+  ring->events[ring->count++ % TRACE_RING_SIZE] =
+    (event_t) { span->name, span->start, end };
+}
+
+bool trace_start (const char *path)
+{
+  if (trace_enabled)
+    return false;
+  trace_path = malloc(strlen(path) + 1);
+  if (!trace_path)
+    return false;
+  strcpy(trace_path, path);
+
+  clock_origin = clock_nanoseconds();
+  trace_origin = trace_clock();
+  trace_enabled = true;
+  return true;
+}
+
+bool trace_stop (void)
+{
+  if (!trace_enabled)
+    return true;
+  trace_enabled = false;
+
+  /* Ticks of the clock per microsecond, measured over the whole trace */
+  double elapsed = (clock_nanoseconds() - clock_origin) / 1000.0;
+  uint64_t ticks = trace_clock() - trace_origin;
+  double scale = (elapsed > 0 && ticks > 0) ? ticks / elapsed : 1000.0;
+
+  FILE *file = fopen(trace_path, "w");
+  free(trace_path);
+  trace_path = NULL;
+  if (!file)
+    return false;
+
+  long pid = getpid();
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  pthread_mutex_lock(&trace_lock);
+  bool first = true;
+  for (ring_t *ring = trace_rings; ring; ring = ring->next) {
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,"
+            "\"tid\":%zu,\"args\":{\"name\":\"thread %zu\"}}",
+            first ? "" : ",\n", pid, ring->thread, ring->thread);
+    first = false;
+
+    size_t count = ring->count;
+    size_t start = 0;
+    if (count > TRACE_RING_SIZE) {
+      start = count % TRACE_RING_SIZE;
+      count = TRACE_RING_SIZE;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      const event_t *event = &ring->events[(start + i) % TRACE_RING_SIZE];
+      if (event->start < trace_origin)
+        continue;
+      fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,"
+              "\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}", event->name, pid,
+              ring->thread, (event->start - trace_origin) / scale,
+              (event->end - event->start) / scale);
+    }
+  }
+  pthread_mutex_unlock(&trace_lock);
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
+
+#else
+
+bool trace_start (const char *path)
+{
+  (void) path;
+  return false;
+}
+
+bool trace_stop (void)
+{
+  return true;
+}
+
+#endif /* TRACE */